@@ -32,14 +32,65 @@ Point::Point(int16_t x, int16_t y)
 
 uint8_t Arduboy2Base::sBuffer[];
 
+bool Arduboy2Base::dirtyTracking = false;
+bool Arduboy2Base::frameDiffing = false;
+bool Arduboy2Base::fullDisplayPending = true;
+#ifdef DISPLAY_GRAYSCALE
+uint8_t Arduboy2Base::grayBuffer[];
+#endif
+#ifdef FRAME_DIFFING
+uint8_t Arduboy2Base::frameShadow[][(HEIGHT*WIDTH)/8];
+#endif
+uint8_t *Arduboy2Base::planeData[];
+#if PAINT_LAYERS > 0
+uint8_t Arduboy2Base::layerBuffer[][(HEIGHT*WIDTH)/8];
+uint8_t Arduboy2Base::drawLayer = 0;
+uint8_t Arduboy2Base::layerInkStart[][HEIGHT/8];
+uint8_t Arduboy2Base::layerInkEnd[][HEIGHT/8];
+#endif
+uint8_t Arduboy2Base::dirtyStart[];
+uint8_t Arduboy2Base::dirtyEnd[];
+uint8_t Arduboy2Base::inkStart[];
+uint8_t Arduboy2Base::inkEnd[];
+
+// Extend the dirty and ink column spans of a page to include column x.
+// Coordinates must already be on screen.
+static inline void markColumn(uint8_t x, uint8_t page, uint8_t *start, uint8_t *end)
+{
+  if (x < start[page]) {
+    start[page] = x;
+  }
+  if (x >= end[page]) {
+    end[page] = x + 1;
+  }
+}
+
 Arduboy2Base::Arduboy2Base()
 {
   currentButtonState = 0;
   previousButtonState = 0;
   // frame management
-  setFrameDuration(16);
+  setFrameRate(60);
   frameCount = 0;
   justRendered = false;
+  nextFrameStart = 0;
+  thisFrameStart = 0;
+  lastFrameDurationUs = 0;
+  missedDeadlineCount = 0;
+  lastDisplayBytes = 0;
+  planeData[0] = sBuffer;
+#ifdef DISPLAY_GRAYSCALE
+  planeData[1] = grayBuffer;
+#endif
+#if PAINT_LAYERS > 0
+  for (uint8_t layer = 1; layer <= PAINT_LAYERS; layer++)
+  {
+    planeData[layer] = layerBuffer[layer - 1];
+    memset(layerInkStart[layer], WIDTH, HEIGHT / 8);
+  }
+#endif
+  // the display contents are unknown until the first full paint
+  markAllDirty();
 }
 
 // functions called here should be public so users can create their
@@ -229,12 +280,25 @@ void Arduboy2Base::waitNoButtons() {
 
 void Arduboy2Base::setFrameRate(uint8_t rate)
 {
-  eachFrameMillis = 1000 / rate;
+  setFrameRate(rate, 1);
+}
+
+void Arduboy2Base::setFrameRate(uint32_t frames, uint32_t seconds)
+{
+  const uint64_t period = (uint64_t)seconds * 1000000;
+
+  eachFrameMicros = period / frames;
+  frameRemainder = period % frames;
+  frameRateDivisor = frames;
+  frameRemainderSum = 0;
 }
 
 void Arduboy2Base::setFrameDuration(uint8_t duration)
 {
-  eachFrameMillis = duration;
+  eachFrameMicros = (uint32_t)duration * 1000;
+  frameRemainder = 0;
+  frameRateDivisor = 1;
+  frameRemainderSum = 0;
 }
 
 bool Arduboy2Base::everyXFrames(uint8_t frames)
@@ -244,35 +308,62 @@ bool Arduboy2Base::everyXFrames(uint8_t frames)
 
 bool Arduboy2Base::nextFrame()
 {
-  uint8_t now = (uint8_t) millis();
-  uint8_t frameDurationMs = now - thisFrameStart;
+  uint32_t now = micros();
+  int32_t remaining = nextFrameStart - now;
 
   if (justRendered) {
-    lastFrameDurationMs = frameDurationMs;
+    lastFrameDurationUs = now - thisFrameStart;
     justRendered = false;
+    if (remaining < 0) {
+      missedDeadlineCount++;
+    }
     return false;
   }
-  else if (frameDurationMs < eachFrameMillis) {
-    // Only idle if at least a full millisecond remains, since idle() may
+  else if (remaining > 1000) {
+    // Only idle if more than a full millisecond remains, since idle() may
     // sleep the processor until the next millisecond timer interrupt.
-    if (++frameDurationMs < eachFrameMillis) {
-      idle();
-    }
-
+    idle();
     return false;
   }
 
+  // Wait out the last part of the frame here, so it starts on time
+  while (remaining > 0) {
+    now = micros();
+    remaining = nextFrameStart - now;
+  }
+
+  // If a whole frame behind, restart the schedule from now rather than
+  // rushing frames to catch up
+  if (-remaining >= (int32_t)eachFrameMicros) {
+    nextFrameStart = now;
+  }
+
+  // The fractional part of the period is added a microsecond at a time,
+  // so the long term rate is exact
+  nextFrameStart += eachFrameMicros;
+  frameRemainderSum += frameRemainder;
+  if (frameRemainderSum >= frameRateDivisor) {
+    frameRemainderSum -= frameRateDivisor;
+    nextFrameStart++;
+  }
+
   // pre-render
   justRendered = true;
   thisFrameStart = now;
   frameCount++;
+  Arduboy2Profile::startFrame();
 
   return true;
 }
 
 int Arduboy2Base::cpuLoad()
 {
-  return lastFrameDurationMs*100 / eachFrameMillis;
+  return lastFrameDurationUs*100 / eachFrameMicros;
+}
+
+uint16_t Arduboy2Base::missedDeadlines()
+{
+  return missedDeadlineCount;
 }
 
 unsigned long Arduboy2Base::generateRandomSeed()
@@ -293,6 +384,65 @@ void Arduboy2Base::clear()
   fillScreen(BLACK);
 }
 
+#if PAINT_LAYERS > 0
+void Arduboy2Base::setDrawLayer(uint8_t layer)
+{
+  if (layer > PAINT_LAYERS || layer == drawLayer)
+    return;
+
+  // swap the contents of the buffers, a word at a time
+  uint32_t *drawn = (uint32_t *)sBuffer;
+  uint32_t *stored = (uint32_t *)planeData[layer];
+  for (uint16_t i = 0; i < WIDTH * HEIGHT / 32; i++)
+  {
+    const uint32_t word = drawn[i];
+    drawn[i] = stored[i];
+    stored[i] = word;
+  }
+  planeData[drawLayer] = (uint8_t *)stored;
+  planeData[layer] = sBuffer;
+
+  memcpy(layerInkStart[drawLayer], inkStart, HEIGHT / 8);
+  memcpy(layerInkEnd[drawLayer], inkEnd, HEIGHT / 8);
+  memcpy(inkStart, layerInkStart[layer], HEIGHT / 8);
+  memcpy(inkEnd, layerInkEnd[layer], HEIGHT / 8);
+
+  drawLayer = layer;
+}
+
+uint8_t Arduboy2Base::getDrawLayer()
+{
+  return drawLayer;
+}
+
+void Arduboy2Base::clearLayer(uint8_t layer)
+{
+  if (layer == drawLayer)
+  {
+    fillScreen(BLACK);
+    return;
+  }
+  if (layer > PAINT_LAYERS)
+    return;
+
+  // only the areas that had been drawn to change
+  for (uint8_t page = 0; page < HEIGHT / 8; page++)
+  {
+    dirtyStart[page] = min(dirtyStart[page], layerInkStart[layer][page]);
+    dirtyEnd[page] = max(dirtyEnd[page], layerInkEnd[layer][page]);
+    layerInkStart[layer][page] = WIDTH;
+    layerInkEnd[layer][page] = 0;
+  }
+  memset(planeData[layer], 0, WIDTH * HEIGHT / 8);
+}
+#endif
+
+inline void Arduboy2Base::markPixelColumn(uint8_t x, uint8_t page)
+{
+  markColumn(x, page, dirtyStart, dirtyEnd);
+  markColumn(x, page, inkStart, inkEnd);
+}
+
 void Arduboy2Base::drawPixel(int16_t x, int16_t y, uint8_t color)
 {
   #ifdef PIXEL_SAFE_MODE
@@ -305,6 +455,8 @@ void Arduboy2Base::drawPixel(int16_t x, int16_t y, uint8_t color)
   uint16_t row_offset;
   uint8_t bit;
 
+  markPixelColumn(x, y / 8);
+
   bit = 1 << (y & 7);
   row_offset = y / 8 * WIDTH + x;
   uint8_t data = sBuffer[row_offset] | bit;
@@ -448,50 +600,130 @@ void Arduboy2Base::drawLine
 (int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint8_t color)
 {
   // bresenham's algorithm - thx wikpedia
-  bool steep = abs(y1 - y0) > abs(x1 - x0);
-  if (steep) {
-    swap(x0, y0);
-    swap(x1, y1);
+  // Stepped along the major axis u, with the minor axis v. Distances are
+  // widened so lines far off the display can be clipped without overflow.
+  const bool steep = abs(y1 - y0) > abs(x1 - x0);
+  int16_t u0 = steep ? y0 : x0;
+  int16_t v0 = steep ? x0 : y0;
+  int16_t u1 = steep ? y1 : x1;
+  int16_t v1 = steep ? x1 : y1;
+
+  if (u0 > u1) {
+    swap(u0, u1);
+    swap(v0, v1);
   }
 
-  if (x0 > x1) {
-    swap(x0, x1);
-    swap(y0, y1);
+  const int32_t dx = (int32_t)u1 - u0;
+  const int32_t dy = abs((int32_t)v1 - v0);
+  const int32_t err0 = dx / 2;
+  const int8_t ystep = (v0 < v1) ? 1 : -1;
+  const int32_t uMax = steep ? HEIGHT - 1 : WIDTH - 1;
+  const int32_t vMax = steep ? WIDTH - 1 : HEIGHT - 1;
+
+  // After k steps the minor axis has moved m(k) = ceil((k*dy - err0) / dx)
+  // pixels (0 if negative). Find the steps where both u and v are on the
+  // display, using the range of m that keeps v on it. The products of two
+  // distances can pass 32 bits, so they're worked out in 64.
+  int32_t kFirst = max(0, -(int32_t)u0);
+  int32_t kLast = min(dx, uMax - u0);
+  const int32_t mLow = (ystep > 0) ? -(int32_t)v0 : v0 - vMax;
+  const int32_t mHigh = (ystep > 0) ? vMax - v0 : (int32_t)v0;
+
+  if (mHigh < 0 || mLow > dy)
+    return;
+  if (dy > 0)
+  {
+    if (mLow > 0)
+      kFirst = max(kFirst, (int32_t)(((int64_t)(mLow - 1) * dx + err0) / dy + 1));
+    if (mHigh < dy)
+      kLast = min(kLast, (int32_t)(((int64_t)mHigh * dx + err0) / dy));
   }
+  else if (mLow > 0)
+    return;
+  if (kFirst > kLast)
+    return;
 
-  int16_t dx, dy;
-  dx = x1 - x0;
-  dy = abs(y1 - y0);
-
-  int16_t err = dx / 2;
-  int8_t ystep;
+  // Start at the first visible step with the error term it would have had
+  const int32_t m = (dx > 0) ? (int32_t)(((int64_t)kFirst * dy - err0 + dx - 1) / dx) : 0;
+  int32_t err = (int32_t)(err0 - (int64_t)kFirst * dy + (int64_t)m * dx);
+  uint8_t u = u0 + kFirst;
+  uint8_t v = v0 + ystep * m;
+  uint16_t count = kLast - kFirst + 1;
+  const uint8_t bits = (color & bit(0)) ? 0xFF : 0;
 
-  if (y0 < y1)
+  if (!steep)
   {
-    ystep = 1;
+    // u is x: step the pointer along the page, moving the bit mask (and
+    // page when it wraps) on minor steps
+    uint8_t page = v / 8;
+    uint8_t mask = 1 << (v & 7);
+    uint8_t *pBuf = sBuffer + page * WIDTH + u;
+    markPixelColumn(u, page);
+
+    while (true)
+    {
+      *pBuf = (*pBuf & ~mask) | (bits & mask);
+      if (--count == 0)
+        break;
+      pBuf++;
+      u++;
+      err -= dy;
+      if (err < 0)
+      {
+        err += dx;
+        mask = (ystep > 0) ? mask << 1 : mask >> 1;
+        if (mask == 0)
+        {
+          markPixelColumn(u - 1, page);
+          if (ystep > 0) {
+            page++;
+            mask = 0x01;
+            pBuf += WIDTH;
+          }
+          else {
+            page--;
+            mask = 0x80;
+            pBuf -= WIDTH;
+          }
+          markPixelColumn(u, page);
+        }
+      }
+    }
+    markPixelColumn(u, page);
   }
   else
   {
-    ystep = -1;
-  }
-
-  for (; x0 <= x1; x0++)
-  {
-    if (steep)
-    {
-      drawPixel(y0, x0, color);
-    }
-    else
-    {
-      drawPixel(x0, y0, color);
-    }
-
-    err -= dy;
-    if (err < 0)
+    // u is y: move the bit mask (and page when it wraps) every step, and
+    // the pointer along the page on minor steps
+    uint8_t page = u / 8;
+    uint8_t mask = 1 << (u & 7);
+    uint8_t *pBuf = sBuffer + page * WIDTH + v;
+    markPixelColumn(v, page);
+
+    while (true)
     {
-      y0 += ystep;
-      err += dx;
+      *pBuf = (*pBuf & ~mask) | (bits & mask);
+      if (--count == 0)
+        break;
+      const uint8_t lastV = v;
+      err -= dy;
+      if (err < 0)
+      {
+        err += dx;
+        v += ystep;
+        pBuf += ystep;
+      }
+      mask <<= 1;
+      if (mask == 0)
+      {
+        markPixelColumn(lastV, page);
+        page++;
+        mask = 0x01;
+        pBuf += WIDTH;
+        markPixelColumn(v, page);
+      }
     }
+    markPixelColumn(v, page);
   }
 }
 
@@ -504,14 +736,42 @@ void Arduboy2Base::drawRect
   drawFastVLine(x+w-1, y, h, color);
 }
 
-void Arduboy2Base::drawFastVLine
-(int16_t x, int16_t y, uint8_t h, uint8_t color)
+// Set the pixels of column x from y0 to y1, inclusive, to the color a page
+// at a time. y is clipped but x must be on the display. The area isn't
+// marked dirty.
+static void fillColumn(uint8_t x, int16_t y0, int16_t y1, uint8_t color)
 {
-  int end = y+h;
-  for (int a = max(0,y); a < min(end,HEIGHT); a++)
+  if (y0 < 0)
+    y0 = 0;
+  if (y1 > HEIGHT - 1)
+    y1 = HEIGHT - 1;
+  if (y0 > y1)
+    return;
+
+  const uint8_t bits = (color & bit(0)) ? 0xFF : 0;
+  const uint8_t lastPage = y1 / 8;
+  uint8_t page = y0 / 8;
+  uint8_t mask = 0xFF << (y0 & 7);
+  uint8_t *pBuf = Arduboy2Base::sBuffer + page * WIDTH + x;
+
+  for (; page < lastPage; page++)
   {
-    drawPixel(x,a,color);
+    *pBuf = (*pBuf & ~mask) | (bits & mask);
+    mask = 0xFF;
+    pBuf += WIDTH;
   }
+  mask &= 0xFF >> (7 - (y1 & 7));
+  *pBuf = (*pBuf & ~mask) | (bits & mask);
+}
+
+void Arduboy2Base::drawFastVLine
+(int16_t x, int16_t y, uint8_t h, uint8_t color)
+{
+  if (x < 0 || x >= WIDTH || h == 0)
+    return;
+
+  markDirty(x, y, 1, h);
+  fillColumn(x, y, y + h - 1, color);
 }
 
 void Arduboy2Base::drawFastHLine
@@ -540,6 +800,8 @@ void Arduboy2Base::drawFastHLine
   // calculate actual width (even if unchanged)
   w = xEnd - x;
 
+  markDirty(x, y, w, 1);
+
   // buffer pointer plus row offset + x offset
   register uint8_t *pBuf = sBuffer + ((y / 8) * WIDTH) + x;
 
@@ -565,14 +827,82 @@ void Arduboy2Base::drawFastHLine
   }
 }
 
+// Set the bits in mask of `width` consecutive bytes of a page to the color,
+// storing 4 bytes at a time where aligned.
+static void fillPageBits(uint8_t *pBuf, uint8_t width, uint8_t mask, uint8_t color)
+{
+  const uint8_t bits = (color & bit(0)) ? mask : 0;
+
+  if (mask == 0xFF)
+  {
+    memset(pBuf, bits, width);
+    return;
+  }
+
+  uint8_t *end = pBuf + width;
+  while (pBuf < end && ((uintptr_t)pBuf & 3))
+  {
+    *pBuf = (*pBuf & ~mask) | bits;
+    pBuf++;
+  }
+
+  const uint32_t mask32 = mask * 0x01010101UL;
+  const uint32_t bits32 = bits * 0x01010101UL;
+  for (; pBuf + 4 <= end; pBuf += 4)
+  {
+    uint32_t *p = (uint32_t *)pBuf;
+    *p = (*p & ~mask32) | bits32;
+  }
+
+  while (pBuf < end)
+  {
+    *pBuf = (*pBuf & ~mask) | bits;
+    pBuf++;
+  }
+}
+
 void Arduboy2Base::fillRect
 (int16_t x, int16_t y, uint8_t w, uint8_t h, uint8_t color)
 {
-  // stupidest version - update in subclasses if desired!
-  for (int16_t i=x; i<x+w; i++)
+  int16_t xEnd = x + w; // last x point + 1
+  int16_t yEnd = y + h; // last y point + 1
+
+  // Clip to the display
+  if (x < 0)
+    x = 0;
+  if (y < 0)
+    y = 0;
+  if (xEnd > WIDTH)
+    xEnd = WIDTH;
+  if (yEnd > HEIGHT)
+    yEnd = HEIGHT;
+  if (x >= xEnd || y >= yEnd)
+    return;
+
+  w = xEnd - x;
+  markDirty(x, y, w, yEnd - y);
+
+  // Pages are filled a whole byte per column, except for the partial bytes
+  // at the top and bottom of the rectangle
+  uint8_t page = y / 8;
+  const uint8_t lastPage = (yEnd - 1) / 8;
+  const uint8_t topMask = 0xFF << (y & 7);
+  const uint8_t bottomMask = 0xFF >> (7 - ((yEnd - 1) & 7));
+  uint8_t *pBuf = sBuffer + page * WIDTH + x;
+
+  if (page == lastPage)
   {
-    drawFastVLine(i, y, h, color);
+    fillPageBits(pBuf, w, topMask & bottomMask, color);
+    return;
   }
+
+  fillPageBits(pBuf, w, topMask, color);
+  while (++page < lastPage)
+  {
+    pBuf += WIDTH;
+    fillPageBits(pBuf, w, 0xFF, color);
+  }
+  fillPageBits(pBuf + WIDTH, w, bottomMask, color);
 }
 
 void Arduboy2Base::fillScreen(uint8_t color)
@@ -580,8 +910,23 @@ void Arduboy2Base::fillScreen(uint8_t color)
   if (color != BLACK)
   {
     color = 0xFF; // all pixels on
+    markDirty(0, 0, WIDTH, HEIGHT);
+  }
+  else
+  {
+    // only the areas that had been drawn to change when clearing
+    for (uint8_t page = 0; page < HEIGHT / 8; page++)
+    {
+      dirtyStart[page] = min(dirtyStart[page], inkStart[page]);
+      dirtyEnd[page] = max(dirtyEnd[page], inkEnd[page]);
+      inkStart[page] = WIDTH;
+      inkEnd[page] = 0;
+    }
   }
   memset(sBuffer, color, WIDTH * HEIGHT / 8);
+#ifdef DISPLAY_GRAYSCALE
+  memset(grayBuffer, 0, WIDTH * HEIGHT / 8);
+#endif
 }
 
 void Arduboy2Base::drawRoundRect
@@ -621,103 +966,133 @@ void Arduboy2Base::drawTriangle
 void Arduboy2Base::fillTriangle
 (int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint8_t color)
 {
+  const Point points[] = { Point(x0, y0), Point(x1, y1), Point(x2, y2) };
+  fillPolygon(points, 3, color);
+}
 
-  int16_t a, b, y, last;
-  // Sort coordinates by Y order (y2 >= y1 >= y0)
-  if (y0 > y1)
-  {
-    swap(y0, y1); swap(x0, x1);
-  }
-  if (y1 > y2)
-  {
-    swap(y2, y1); swap(x2, x1);
-  }
-  if (y0 > y1)
+void Arduboy2Base::fillPolygon(const Point points[], uint8_t count, uint8_t color)
+{
+  if (count == 0 || count > POLYGON_MAX_POINTS)
+    return;
+
+  int16_t xMin = points[0].x, xMax = xMin;
+  int16_t yMin = points[0].y, yMax = yMin;
+  for (uint8_t i = 1; i < count; i++)
   {
-    swap(y0, y1); swap(x0, x1);
+    xMin = min(xMin, points[i].x);
+    xMax = max(xMax, points[i].x);
+    yMin = min(yMin, points[i].y);
+    yMax = max(yMax, points[i].y);
   }
 
-  if(y0 == y2)
-  { // Handle awkward all-on-same-line case as its own thing
-    a = b = x0;
-    if(x1 < a)
-    {
-      a = x1;
-    }
-    else if(x1 > b)
-    {
-      b = x1;
-    }
-    if(x2 < a)
-    {
-      a = x2;
-    }
-    else if(x2 > b)
-    {
-      b = x2;
-    }
-    drawFastHLine(a, y0, b-a+1, color);
+  const int16_t xFirst = max(xMin, 0);
+  const int16_t xLast = min(xMax, WIDTH - 1);
+  const int16_t yFirst = max(yMin, 0);
+  const int16_t yLast = min(yMax, HEIGHT - 1);
+  if (xFirst > xLast || yFirst > yLast)
     return;
-  }
 
-  int16_t dx01 = x1 - x0,
-      dy01 = y1 - y0,
-      dx02 = x2 - x0,
-      dy02 = y2 - y0,
-      dx12 = x2 - x1,
-      dy12 = y2 - y1,
-      sa = 0,
-      sb = 0;
-
-  // For upper part of triangle, find scanline crossings for segments
-  // 0-1 and 0-2.  If y1=y2 (flat-bottomed triangle), the scanline y1
-  // is included here (and second loop will be skipped, avoiding a /0
-  // error there), otherwise scanline y1 is skipped here and handled
-  // in the second loop...which also avoids a /0 error here if y0=y1
-  // (flat-topped triangle).
-  if (y1 == y2)
+  markDirty(xFirst, yFirst, xLast - xFirst + 1, yLast - yFirst + 1);
+
+  // For each column, find where the edges cross it and fill between pairs
+  // of crossings. An edge covers the columns from its left end up to, but
+  // not including, its right end, so a corner shared by two edges is
+  // counted once where the outline passes through it and twice where it
+  // turns back.
+  //
+  // Each edge's y, rounded to the nearest pixel, is
+  //   left.y + floor((2 * (x - left.x) * (right.y - left.y) + dx) / (2 * dx))
+  // which is stepped along x as a quotient and remainder.
+  struct Edge
   {
-    last = y1;   // Include y1 scanline
-  }
-  else
+    int16_t xStart, xEnd; // columns covered
+    int16_t y;            // y at the current column
+    int16_t yStep;        // whole part of the change in y per column
+    int32_t rem;          // remainder, 0 <= rem < den
+    int32_t remStep;
+    int32_t den;
+  };
+  Edge edges[POLYGON_MAX_POINTS];
+  uint8_t edgeCount = 0;
+
+  for (uint8_t i = 0; i < count; i++)
   {
-    last = y1-1; // Skip it
+    const Point &p0 = points[i];
+    const Point &p1 = points[(i + 1 < count) ? i + 1 : 0];
+    const Point &left = (p0.x < p1.x) ? p0 : p1;
+    const Point &right = (p0.x < p1.x) ? p1 : p0;
+    const int16_t xStart = max(left.x, xFirst);
+    const int16_t xEnd = min(right.x, xLast + 1);
+    if (xStart >= xEnd)
+      continue;
+
+    Edge &e = edges[edgeCount++];
+    e.xStart = xStart;
+    e.xEnd = xEnd;
+    e.den = 2 * ((int32_t)right.x - left.x);
+
+    // start at the first visible column, which only needs a (64 bit)
+    // division when the edge is clipped
+    int32_t q = 0;
+    int32_t r = e.den / 2;
+    if (xStart > left.x) {
+      const int64_t num = 2 * (int64_t)(xStart - left.x) * (right.y - left.y) + r;
+      q = num / e.den;
+      r = num % e.den;
+      if (r < 0) {
+        q--;
+        r += e.den;
+      }
+    }
+    e.y = left.y + q;
+    e.rem = r;
+
+    const int32_t step = 2 * ((int32_t)right.y - left.y);
+    q = step / e.den;
+    r = step % e.den;
+    if (r < 0) {
+      q--;
+      r += e.den;
+    }
+    e.yStep = q;
+    e.remStep = r;
   }
 
-
-  for(y = y0; y <= last; y++)
+  int16_t crossings[POLYGON_MAX_POINTS];
+  for (int16_t x = xFirst; x <= xLast; x++)
   {
-    a   = x0 + sa / dy01;
-    b   = x0 + sb / dy02;
-    sa += dx01;
-    sb += dx02;
-
-    if(a > b)
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < edgeCount; i++)
     {
-      swap(a,b);
+      Edge &e = edges[i];
+      if (x < e.xStart || x >= e.xEnd)
+        continue;
+
+      // keep the crossings sorted
+      const int16_t y = e.y;
+      uint8_t j = n++;
+      for (; j > 0 && crossings[j - 1] > y; j--)
+        crossings[j] = crossings[j - 1];
+      crossings[j] = y;
+
+      e.y += e.yStep;
+      e.rem += e.remStep;
+      if (e.rem >= e.den) {
+        e.rem -= e.den;
+        e.y++;
+      }
     }
 
-    drawFastHLine(a, y, b-a+1, color);
+    for (uint8_t i = 0; i + 1 < n; i += 2)
+      fillColumn(x, crossings[i], crossings[i + 1], color);
   }
 
-  // For lower part of triangle, find scanline crossings for segments
-  // 0-2 and 1-2.  This loop is skipped if y1=y2.
-  sa = dx12 * (y - y1);
-  sb = dx02 * (y - y0);
-
-  for(; y <= y2; y++)
+  // The spans end at the rounded edges, so draw the edges to close the shape
+  for (uint8_t i = 0; i < count; i++)
   {
-    a   = x1 + sa / dy12;
-    b   = x0 + sb / dy02;
-    sa += dx12;
-    sb += dx02;
-
-    if(a > b)
-    {
-      swap(a,b);
-    }
-
-    drawFastHLine(a, y, b-a+1, color);
+    const Point &p0 = points[i];
+    const Point &p1 = points[(i + 1 < count) ? i + 1 : 0];
+    drawLine(p0.x, p0.y, p1.x, p1.y, color);
   }
 }
 
@@ -729,6 +1104,9 @@ void Arduboy2Base::drawBitmap
   if (x+w < 0 || x > WIDTH-1 || y+h < 0 || y > HEIGHT-1)
     return;
 
+  // whole pages are drawn, including any padding rows below the bitmap
+  markDirty(x, y, w, (h + 7) & ~7);
+
   int yOffset = abs(y) % 8;
   int sRow = y / 8;
   if (y < 0) {
@@ -786,36 +1164,57 @@ void Arduboy2Base::drawSlowXYBitmap
 
 
 // Helper for drawCompressed()
+// Bits are read from the least significant end of each byte, so they're
+// kept in a 32 bit buffer with the next bit to be read in bit 0.
 struct BitStreamReader
 {
   const uint8_t *source;
-  uint16_t sourceIndex;
-  uint8_t bitBuffer;
-  uint8_t byteBuffer;
+  uint32_t bitBuffer;
+  uint8_t bitCount;
 
   BitStreamReader(const uint8_t *source)
-    : source(source), sourceIndex(), bitBuffer(), byteBuffer()
+    : source(source), bitBuffer(), bitCount()
   {
   }
 
-  uint16_t readBits(uint16_t bitCount)
+  // Top up the buffer to at least `count` bits, a byte at a time. Only
+  // bytes holding bits that are about to be read are loaded, so reading
+  // never goes past the end of the compressed array.
+  void fill(uint8_t count)
   {
-    uint16_t result = 0;
-    for (uint16_t i = 0; i < bitCount; i++)
+    while (bitCount < count)
     {
-      if (this->bitBuffer == 0)
-      {
-        this->bitBuffer = 0x1;
-        this->byteBuffer = pgm_read_byte(&this->source[this->sourceIndex]);
-        ++this->sourceIndex;
-      }
+      bitBuffer |= (uint32_t)pgm_read_byte(source++) << bitCount;
+      bitCount += 8;
+    }
+  }
 
-      if ((this->byteBuffer & this->bitBuffer) != 0)
-        result |= (1 << i);
+  // read up to 17 bits
+  uint16_t readBits(uint8_t count)
+  {
+    fill(count);
+    uint16_t result = bitBuffer & ((1UL << count) - 1);
+    bitBuffer >>= count;
+    bitCount -= count;
+    return result;
+  }
 
-      this->bitBuffer <<= 1;
+  // Read an Elias gamma coded span length. Every 0 before the first 1 adds
+  // 2 bits to the length of the value that follows it. No valid span has
+  // more than 8 of them, which also keeps a corrupt stream from running
+  // the count past the buffer.
+  uint16_t readSpan()
+  {
+    // bits above bitCount are always 0, so only load more while all of
+    // the loaded ones are
+    while (bitCount < 9 && bitBuffer == 0)
+    {
+      fill(bitCount + 1);
     }
-    return result;
+    uint8_t zeros = __builtin_ctz(bitBuffer | 0x100);
+    bitBuffer >>= zeros + 1;
+    bitCount -= zeros + 1;
+    return readBits(zeros * 2 + 1) + 1;
   }
 };
 
@@ -833,95 +1232,352 @@ void Arduboy2Base::drawCompressed(int16_t sx, int16_t sy, const uint8_t *bitmap,
   if ((sx + width < 0) || (sx > WIDTH - 1) || (sy + height < 0) || (sy > HEIGHT - 1))
     return;
 
-  // sy = sy - (frame * height);
-  int yOffset = abs(sy) % 8;
-  int startRow = sy / 8;
-  if (sy < 0) {
-    startRow--;
-    yOffset = 8 - yOffset;
+  uint8_t cachedWidth, cachedHeight;
+  const uint8_t *image = Arduboy2ImageCache::get(bitmap, cachedWidth, cachedHeight);
+
+  if (image != NULL)
+  {
+    // The decoder below draws the padding rows of the last page too, so
+    // when the image is just above the display those rows can still be on
+    // it. Draw that page on its own, as drawBitmap() would skip the image.
+    if (sy + cachedHeight <= 0)
+    {
+      const uint8_t lastPage = (cachedHeight - 1) / 8;
+      image += lastPage * cachedWidth;
+      sy += lastPage * 8;
+      cachedHeight = 8;
+    }
+    Sprites::drawBitmap(sx, sy, image, NULL, cachedWidth, cachedHeight,
+                        color != 0 ? SPRITE_IS_MASK : SPRITE_IS_MASK_ERASE);
+    return;
   }
+
+  // whole pages are decoded, including any padding rows below the image
+  markDirty(sx, sy, width, (height + 7) & ~7);
+
+  const uint8_t yOffset = sy & 7;
+  const int startRow = (sy - yOffset) / 8;
   int rows = height / 8;
   if ((height % 8) != 0)
     ++rows;
 
-  int rowOffset = 0; // +(frame*rows);
+  int rowOffset = 0;
   int columnOffset = 0;
 
   uint8_t byte = 0x00;
-  uint8_t bit = 0x01;
-  while (rowOffset < rows) // + (frame*rows))
+  uint8_t bitOffset = 0;
+  while (rowOffset < rows)
   {
-    uint16_t bitLength = 1;
-    while (cs.readBits(1) == 0)
-      bitLength += 2;
-
-    uint16_t len = cs.readBits(bitLength) + 1; // span length
+    uint16_t len = cs.readSpan();
 
-    // draw the span
-    for (uint16_t i = 0; i < len; ++i)
+    while (len > 0)
     {
+      // a run of whole bytes of 0 leaves the buffer as it is, so skip it
+      if (bitOffset == 0 && len >= 8 && spanColour == 0)
+      {
+        columnOffset += len / 8;
+        rowOffset += columnOffset / width;
+        columnOffset %= width;
+        len %= 8;
+        if (rowOffset >= rows)
+          return;
+        continue;
+      }
+
+      // add as much of the span as fits in the byte
+      uint8_t count = min(len, 8 - bitOffset);
       if (spanColour != 0)
-        byte |= bit;
-      bit <<= 1;
+        byte |= ((1 << count) - 1) << bitOffset;
+      bitOffset += count;
+      len -= count;
 
-      if (bit == 0) // reached end of byte
-      {
-        // draw
-        int bRow = startRow + rowOffset;
+      if (bitOffset < 8)
+        break;
+
+      // reached end of byte, so draw it
+      int bRow = startRow + rowOffset;
+      int bCol = sx + columnOffset;
 
-        //if (byte) // possible optimisation
-        if ((bRow <= (HEIGHT / 8) - 1) && (bRow > -2) &&
-            (columnOffset + sx <= (WIDTH - 1)) && (columnOffset + sx >= 0))
+      if (byte && (bRow <= (HEIGHT / 8) - 1) && (bRow > -2) &&
+          (bCol <= (WIDTH - 1)) && (bCol >= 0))
+      {
+        uint8_t *pBuf = sBuffer + (bRow * WIDTH) + bCol;
+        if (bRow >= 0)
         {
-          int16_t offset = (bRow * WIDTH) + sx + columnOffset;
-          if (bRow >= 0)
-          {
-            int16_t index = offset;
-            uint8_t value = byte << yOffset;
-
-            if (color != 0)
-              sBuffer[index] |= value;
-            else
-              sBuffer[index] &= ~value;
-          }
-          if ((yOffset != 0) && (bRow < (HEIGHT / 8) - 1))
-          {
-            int16_t index = offset + WIDTH;
-            uint8_t value = byte >> (8 - yOffset);
+          uint8_t value = byte << yOffset;
 
-            if (color != 0)
-              sBuffer[index] |= value;
-            else
-              sBuffer[index] &= ~value;
-          }
+          if (color != 0)
+            *pBuf |= value;
+          else
+            *pBuf &= ~value;
         }
-
-        // iterate
-        ++columnOffset;
-        if (columnOffset >= width)
+        if ((yOffset != 0) && (bRow < (HEIGHT / 8) - 1))
         {
-          columnOffset = 0;
-          ++rowOffset;
+          uint8_t value = byte >> (8 - yOffset);
+
+          if (color != 0)
+            pBuf[WIDTH] |= value;
+          else
+            pBuf[WIDTH] &= ~value;
         }
+      }
 
-        // reset byte
-        byte = 0x00;
-        bit = 0x01;
+      // iterate
+      if (++columnOffset >= width)
+      {
+        columnOffset = 0;
+        if (++rowOffset >= rows)
+          return;
       }
+
+      // reset byte
+      byte = 0x00;
+      bitOffset = 0;
     }
 
     spanColour ^= 0x01; // toggle colour bit (bit 0) for next span
   }
 }
 
+void Arduboy2Base::decompress(const uint8_t *bitmap, uint8_t *image)
+{
+  BitStreamReader cs = BitStreamReader(bitmap);
+
+  uint16_t width = cs.readBits(8) + 1;
+  uint16_t height = cs.readBits(8) + 1;
+  uint8_t spanColour = (uint8_t)cs.readBits(1);
+
+  const uint32_t bits = (uint32_t)width * ((height + 7) / 8) * 8;
+  uint32_t pos = 0;
+
+  memset(image, 0, bits / 8);
+
+  while (pos < bits)
+  {
+    uint32_t end = pos + cs.readSpan();
+    if (end > bits)
+      end = bits;
+
+    // the bits of a set span are filled a byte at a time where possible
+    if (spanColour != 0)
+    {
+      while (pos < end && (pos & 7) != 0)
+      {
+        image[pos / 8] |= 1 << (pos & 7);
+        ++pos;
+      }
+      if (end - pos >= 8)
+      {
+        memset(image + pos / 8, 0xFF, (end - pos) / 8);
+        pos += (end - pos) & ~7UL;
+      }
+      while (pos < end)
+      {
+        image[pos / 8] |= 1 << (pos & 7);
+        ++pos;
+      }
+    }
+    pos = end;
+
+    spanColour ^= 0x01;
+  }
+}
+
 void Arduboy2Base::display()
 {
-  paintScreen(sBuffer);
+  display(false);
 }
 
 void Arduboy2Base::display(bool clear)
 {
-  paintScreen(sBuffer, clear);
+  Arduboy2Profile::startDisplay();
+
+  if (fullPaintNeeded() || fullDisplayPending || !(dirtyTracking || frameDiffing))
+  {
+#if PAINT_LAYERS > 0
+    paintLayers(planeData);
+#elif defined(DISPLAY_GRAYSCALE)
+    paintGrayScreen(planeData);
+#else
+    paintScreen(sBuffer);
+#endif
+    lastDisplayBytes = BYTES_FOR_REGION(S_WIDTH, S_HEIGHT);
+    fullDisplayPending = false;
+  }
+#ifdef FRAME_DIFFING
+  else if (frameDiffing)
+  {
+    lastDisplayBytes = paintFrameChanges();
+  }
+#endif
+  else
+  {
+    lastDisplayBytes = paintDirtySpans();
+  }
+
+#ifdef FRAME_DIFFING
+  if (frameDiffing)
+  {
+    for (uint8_t plane = 0; plane < BUFFER_PLANES; plane++)
+    {
+      memcpy(frameShadow[plane], planeData[plane], WIDTH * HEIGHT / 8);
+    }
+  }
+#endif
+
+  for (uint8_t page = 0; page < HEIGHT / 8; page++)
+  {
+    dirtyStart[page] = WIDTH;
+    dirtyEnd[page] = 0;
+  }
+
+  if (clear)
+  {
+    fillScreen(BLACK);
+  }
+}
+
+uint32_t Arduboy2Base::paintDirtySpans()
+{
+  uint32_t bytes = 0;
+  uint8_t page = 0;
+
+  while (page < HEIGHT / 8)
+  {
+    const uint8_t start = dirtyStart[page];
+    const uint8_t end = dirtyEnd[page];
+    uint8_t pages = 1;
+
+    // send pages with identical spans as one rectangle
+    while (page + pages < HEIGHT / 8 &&
+           dirtyStart[page + pages] == start && dirtyEnd[page + pages] == end)
+    {
+      pages++;
+    }
+
+    if (start < end)
+    {
+      bytes += paintArea(start, page * 8, end - start, pages * 8);
+    }
+    page += pages;
+  }
+
+  return bytes;
+}
+
+#ifdef FRAME_DIFFING
+// Check if 4 columns of a page of any plane differ from the last frame sent
+static inline bool columnsChanged(uint8_t *const planes[], const uint8_t shadow[][(HEIGHT*WIDTH)/8], uint16_t offset)
+{
+  for (uint8_t plane = 0; plane < BUFFER_PLANES; plane++)
+  {
+    if (*(const uint32_t *)(planes[plane] + offset) != *(const uint32_t *)(shadow[plane] + offset))
+      return true;
+  }
+  return false;
+}
+
+uint32_t Arduboy2Base::paintFrameChanges()
+{
+  uint32_t bytes = 0;
+
+  // Compare 4 columns of a page at a time, which is also the smallest
+  // width paintRegion() can send.
+  for (uint8_t page = 0; page < HEIGHT / 8; page++)
+  {
+    const uint16_t offset = page * WIDTH;
+    uint8_t word = 0;
+
+    while (word < WIDTH / 4)
+    {
+      if (!columnsChanged(planeData, frameShadow, offset + word * 4))
+      {
+        word++;
+        continue;
+      }
+
+      const uint8_t start = word;
+      do
+      {
+        word++;
+      }
+      while (word < WIDTH / 4 && columnsChanged(planeData, frameShadow, offset + word * 4));
+
+      bytes += paintArea(start * 4, page * 8, (word - start) * 4, 8);
+    }
+  }
+
+  return bytes;
+}
+#endif
+
+uint32_t Arduboy2Base::paintArea(uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+#if PAINT_LAYERS > 0
+  return paintLayerRegion(planeData, x, y, width, height);
+#elif defined(DISPLAY_GRAYSCALE)
+  return paintGrayRegion(planeData, x, y, width, height);
+#else
+  return paintRegion(sBuffer, x, y, width, height);
+#endif
+}
+
+void Arduboy2Base::setFrameDiffing(bool enabled)
+{
+#ifdef FRAME_DIFFING
+  frameDiffing = enabled;
+  markAllDirty();
+#else
+  (void)enabled;
+#endif
+}
+
+bool Arduboy2Base::getFrameDiffing()
+{
+  return frameDiffing;
+}
+
+void Arduboy2Base::setDirtyTracking(bool enabled)
+{
+  dirtyTracking = enabled;
+  markAllDirty();
+}
+
+bool Arduboy2Base::getDirtyTracking()
+{
+  return dirtyTracking;
+}
+
+void Arduboy2Base::markDirty(int16_t x, int16_t y, int16_t w, int16_t h)
+{
+  const int16_t xEnd = min(x + w, WIDTH);
+  const int16_t yEnd = min(y + h, HEIGHT);
+
+  if (x < 0)
+    x = 0;
+  if (y < 0)
+    y = 0;
+  if (x >= xEnd || y >= yEnd)
+    return;
+
+  for (uint8_t page = y / 8; page <= (yEnd - 1) / 8; page++)
+  {
+    dirtyStart[page] = min(dirtyStart[page], x);
+    dirtyEnd[page] = max(dirtyEnd[page], xEnd);
+    inkStart[page] = min(inkStart[page], x);
+    inkEnd[page] = max(inkEnd[page], xEnd);
+  }
+}
+
+void Arduboy2Base::markAllDirty()
+{
+  markDirty(0, 0, WIDTH, HEIGHT);
+  fullDisplayPending = true;
+}
+
+uint32_t Arduboy2Base::displayBytes()
+{
+  return lastDisplayBytes;
 }
 
 uint8_t* Arduboy2Base::getBuffer()
@@ -1165,10 +1821,44 @@ size_t Arduboy2::write(uint8_t c)
   return 1;
 }
 
+size_t Arduboy2::write(const uint8_t *buffer, size_t size)
+{
+  // non-virtual calls, so print() of strings and numbers doesn't dispatch
+  // through Print for every character
+  for (size_t i = 0; i < size; i++)
+  {
+    Arduboy2::write(buffer[i]);
+  }
+  return size;
+}
+
+// Each nibble of a font column stretched vertically for text sizes 2 to 4,
+// with every bit repeated size times.
+static const uint16_t charStretch[3][16] PROGMEM =
+{
+  { 0x0000, 0x0003, 0x000C, 0x000F, 0x0030, 0x0033, 0x003C, 0x003F,
+    0x00C0, 0x00C3, 0x00CC, 0x00CF, 0x00F0, 0x00F3, 0x00FC, 0x00FF },
+  { 0x0000, 0x0007, 0x0038, 0x003F, 0x01C0, 0x01C7, 0x01F8, 0x01FF,
+    0x0E00, 0x0E07, 0x0E38, 0x0E3F, 0x0FC0, 0x0FC7, 0x0FF8, 0x0FFF },
+  { 0x0000, 0x000F, 0x00F0, 0x00FF, 0x0F00, 0x0F0F, 0x0FF0, 0x0FFF,
+    0xF000, 0xF00F, 0xF0F0, 0xF0FF, 0xFF00, 0xFF0F, 0xFFF0, 0xFFFF }
+};
+
+// Stretch a font column to 8 * size bits. Size must be 1 to 4.
+static inline uint32_t stretchColumn(uint8_t bits, uint8_t size)
+{
+  if (size == 1)
+  {
+    return bits;
+  }
+  const uint16_t *table = charStretch[size - 2];
+  return pgm_read_word(table + (bits & 0x0F)) |
+         ((uint32_t)pgm_read_word(table + (bits >> 4)) << (size * 4));
+}
+
 void Arduboy2::drawChar
   (int16_t x, int16_t y, unsigned char c, uint8_t color, uint8_t bg, uint8_t size)
 {
-  uint8_t line;
   bool draw_background = bg != color;
   const unsigned char* bitmap = font + c * 5;
 
@@ -1181,27 +1871,98 @@ void Arduboy2::drawChar
     return;
   }
 
-  for (uint8_t i = 0; i < 6; i++ )
+  // A pixel is drawn if its color is non-zero or the background is drawn.
+  // Build masks selecting which of the glyph (fg) and background (bg) bits
+  // of a column get set and which get cleared.
+  const uint8_t fgSet = (color & bit(0)) ? 0xFF : 0;
+  const uint8_t fgClear = ((color || draw_background) && !fgSet) ? 0xFF : 0;
+  const uint8_t bgSet = (bg & bit(0)) ? 0xFF : 0;
+  const uint8_t bgClear = ((bg || draw_background) && !bgSet) ? 0xFF : 0;
+
+  if (size == 0 || !(fgSet | fgClear | bgSet | bgClear))
   {
-    line = pgm_read_byte(bitmap++);
-    if (i == 5) {
-      line = 0x0;
-    }
+    return;
+  }
 
-    for (uint8_t j = 0; j < 8; j++)
+  if (size > 4)
+  {
+    // too tall for a 32 bit column, so fill runs of equal pixels instead
+    for (uint8_t i = 0; i < 6; i++)
     {
-      uint8_t draw_color = (line & 0x1) ? color : bg;
+      const uint8_t line = (i == 5) ? 0 : pgm_read_byte(bitmap + i);
+      const uint8_t setBits = (line & fgSet) | (~line & bgSet);
+      const uint8_t clearBits = (line & fgClear) | (~line & bgClear);
+      uint8_t j = 0;
 
-      if (draw_color || draw_background) {
-        for (uint8_t a = 0; a < size; a++ ) {
-          for (uint8_t b = 0; b < size; b++ ) {
-            drawPixel(x + (i * size) + a, y + (j * size) + b, draw_color);
-          }
+      while (j < 8)
+      {
+        // 1 to set, 2 to clear, 0 to leave the run undrawn
+        const uint8_t kind = ((setBits >> j) & 1) | (((clearBits >> j) & 1) << 1);
+        const uint8_t start = j;
+
+        do
+        {
+          j++;
+        } while (j < 8 && kind == (((setBits >> j) & 1) | (((clearBits >> j) & 1) << 1)));
+
+        const int16_t top = max(y + start * size, 0);
+        const int16_t bottom = min(y + j * size, HEIGHT);
+
+        if (kind && top < bottom)
+        {
+          fillRect(x + i * size, top, size, bottom - top, kind == 1 ? WHITE : BLACK);
         }
       }
-      line >>= 1;
     }
+    return;
   }
+
+  // Columns are shifted down to the pixel row within the first page.
+  // The page above the screen, when the character starts above it, is
+  // skipped along with the column bits it would hold.
+  int8_t page = y >> 3;
+  const uint8_t shift = y & 7;
+  uint8_t skip = 0;
+
+  if (page < 0)
+  {
+    skip = -page;
+    page = 0;
+  }
+
+  const uint8_t pages = min((uint8_t)(HEIGHT / 8 - page),
+                            (uint8_t)((shift + 8 * size + 7) / 8 - skip));
+  int16_t columnX = x;
+
+  for (uint8_t i = 0; i < 6; i++)
+  {
+    const uint8_t line = (i == 5) ? 0 : pgm_read_byte(bitmap + i);
+    const uint64_t setBits = (uint64_t)stretchColumn((line & fgSet) | (~line & bgSet), size)
+                             << shift >> (skip * 8);
+    const uint64_t clearBits = (uint64_t)stretchColumn((line & fgClear) | (~line & bgClear), size)
+                               << shift >> (skip * 8);
+
+    for (uint8_t a = 0; a < size; a++, columnX++)
+    {
+      if (columnX < 0 || columnX >= WIDTH)
+      {
+        continue;
+      }
+
+      uint8_t *pBuf = sBuffer + page * WIDTH + columnX;
+      uint64_t set = setBits;
+      uint64_t clear = clearBits;
+
+      for (uint8_t p = 0; p < pages; p++, pBuf += WIDTH)
+      {
+        *pBuf = (*pBuf & ~(uint8_t)clear) | (uint8_t)set;
+        set >>= 8;
+        clear >>= 8;
+      }
+    }
+  }
+
+  markDirty(x, y, 6 * size, 8 * size);
 }
 
 void Arduboy2::setCursor(int16_t x, int16_t y)
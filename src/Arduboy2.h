@@ -11,6 +11,7 @@
 #include <FlashAsEEPROM.h>
 #include "Arduboy2Core.h"
 #include "Arduboy2Beep.h"
+#include "Arduboy2ImageCache.h"
 #include "Sprites.h"
 #include "SpritesB.h"
 #include <Print.h>
@@ -71,6 +72,11 @@
 // Pixels that would exceed the display limits will be ignored.
 #define PIXEL_SAFE_MODE
 
+// The most corners a polygon passed to fillPolygon() can have
+#ifndef POLYGON_MAX_POINTS
+#define POLYGON_MAX_POINTS 16
+#endif
+
 // pixel colors
 #define BLACK 0  /**< Color value for an unlit pixel for draw functions. */
 #define WHITE 1  /**< Color value for a lit pixel for draw functions. */
@@ -429,10 +435,74 @@ class Arduboy2Base : public Arduboy2Core
    * \details
    * The entire contents of the screen buffer are cleared to BLACK.
    *
-   * \see display(bool)
+   * When `PAINT_LAYERS` is set, only the layer being drawn to is cleared.
+   * With `DISPLAY_GRAYSCALE`, `grayBuffer` is also cleared.
+   *
+   * \see display(bool) clearLayer()
    */
   void clear();
 
+#if PAINT_LAYERS > 0
+  /** \brief
+   * Choose the layer that drawing functions draw to.
+   *
+   * \param layer The layer, from 0 to `PAINT_LAYERS`.
+   *
+   * \details
+   * When `PAINT_LAYERS` is set in `Arduboy2Core.h`, `display()` combines
+   * that many extra layers with the display buffer, each drawn in its own
+   * color and with the highest priority layer shown where they overlap.
+   * All layers start with the same priority, so layer 0 is in front of
+   * layer 1, and layer 1 in front of layer 2. A static background or status
+   * display can then be drawn once to its own layer, and only the layers
+   * that change have to be cleared and drawn again each frame.
+   *
+   * The contents of the chosen layer are swapped into `sBuffer`, so all of
+   * the library's drawing functions, and sketches that use `sBuffer`
+   * directly, draw to it. Layer 0 is drawn to until this is called.
+   *
+   * \code{.cpp}
+   * void setup() {
+   *   arduboy.begin();
+   *   arduboy.setLayerColor(1, TFT_BLUE);
+   *   arduboy.setDrawLayer(1);
+   *   drawBackground();
+   *   arduboy.setDrawLayer(0);
+   * }
+   *
+   * void loop() {
+   *   if (!arduboy.nextFrame()) {
+   *     return;
+   *   }
+   *   drawPlayer();  // only layer 0 is redrawn
+   *   arduboy.display(CLEAR_BUFFER);
+   * }
+   * \endcode
+   *
+   * \see getDrawLayer() clearLayer() setLayerColor() setLayerPriority()
+   */
+  void setDrawLayer(uint8_t layer);
+
+  /** \brief
+   * Get the layer that drawing functions draw to.
+   *
+   * \see setDrawLayer()
+   */
+  uint8_t getDrawLayer();
+
+  /** \brief
+   * Clear a layer.
+   *
+   * \param layer The layer, from 0 to `PAINT_LAYERS`.
+   *
+   * \details
+   * The layer can be cleared without making it the layer that is drawn to.
+   *
+   * \see clear() setDrawLayer()
+   */
+  void clearLayer(uint8_t layer);
+#endif
+
   /** \brief
    * Copy the contents of the display buffer to the display.
    *
@@ -440,7 +510,12 @@ class Arduboy2Base : public Arduboy2Core
    * The contents of the display buffer in RAM are copied to the display and
    * will appear on the screen.
    *
-   * \see display(bool)
+   * \note
+   * If `DISPLAY_DMA` is defined in `Arduboy2Core.h`, this function returns
+   * while the end of the frame is still being sent to the display. The
+   * display buffer can be drawn to immediately.
+   *
+   * \see display(bool) waitDisplay()
    */
   void display();
 
@@ -456,6 +531,7 @@ class Arduboy2Base : public Arduboy2Core
    * Operation is the same as calling `display()` without parameters except
    * additionally the display buffer will be cleared if the parameter evaluates
    * to `true`. (The defined value `CLEAR_BUFFER` can be used for this)
+   * When `PAINT_LAYERS` is set, only the layer being drawn to is cleared.
    *
    * Using `display(CLEAR_BUFFER)` is faster and produces less code than
    * calling `display()` followed by `clear()`.
@@ -464,6 +540,115 @@ class Arduboy2Base : public Arduboy2Core
    */
   void display(bool clear);
 
+  /** \brief
+   * Enable or disable sending only the changed parts of the display buffer.
+   *
+   * \param enabled `true` to send only changed areas with `display()`.
+   * `false` to send the entire display buffer every time (the default).
+   *
+   * \details
+   * The library's drawing functions, including those of the `Sprites`,
+   * `SpritesB` and `Arduboy2` text functions, keep track of the columns
+   * they change in each 8 pixel high page of the display buffer. When
+   * tracking is enabled, `display()` sends only those areas to the display,
+   * which can greatly reduce transfer time when only a small part of the
+   * screen changes each frame.
+   *
+   * A full update is still done after the colors are changed or `blank()`
+   * is called. `markAllDirty()` can be used to force one.
+   *
+   * \note
+   * A sketch that writes to `sBuffer` directly, or paints other images
+   * using `paintScreen()`, must report the areas it changed using
+   * `markDirty()` or `markAllDirty()`, or leave tracking disabled.
+   *
+   * \see markDirty() markAllDirty() displayBytes() display() setFrameDiffing()
+   */
+  void setDirtyTracking(bool enabled);
+
+  /** \brief
+   * Get the state of dirty area tracking.
+   *
+   * \return `true` if `display()` only sends changed areas.
+   *
+   * \see setDirtyTracking()
+   */
+  bool getDirtyTracking();
+
+  /** \brief
+   * Enable or disable sending only the parts of the display buffer that
+   * differ from the previous frame.
+   *
+   * \param enabled `true` to compare each frame with the last one sent.
+   * `false` to disable comparing (the default).
+   *
+   * \details
+   * Only available when `FRAME_DIFFING` is defined in `Arduboy2Core.h`.
+   * Otherwise this does nothing.
+   *
+   * When enabled, `display()` keeps a copy of the frame it last sent. Each
+   * page of the display buffer is compared with it 4 columns at a time and
+   * only the runs of changed columns are sent to the display.
+   *
+   * Unlike `setDirtyTracking()` this works no matter how the display buffer
+   * was changed, including by writing to `sBuffer` directly, at the cost of
+   * 1 KB of RAM (per layer when `PAINT_LAYERS` is set, or 2 KB with
+   * `DISPLAY_GRAYSCALE`) and a fast compare of the buffer each frame. If
+   * both are enabled, comparing is used.
+   *
+   * \see setDirtyTracking() displayBytes() display()
+   */
+  void setFrameDiffing(bool enabled);
+
+  /** \brief
+   * Get the state of frame comparing.
+   *
+   * \return `true` if `display()` only sends areas that differ from the
+   * previous frame.
+   *
+   * \see setFrameDiffing()
+   */
+  bool getFrameDiffing();
+
+  /** \brief
+   * Report that an area of the display buffer has changed.
+   *
+   * \param x The X coordinate of the left edge of the area.
+   * \param y The Y coordinate of the top edge of the area.
+   * \param w The width of the area.
+   * \param h The height of the area.
+   *
+   * \details
+   * The area will be sent by the next `display()` when dirty tracking is
+   * enabled. This is done automatically by the library's drawing
+   * functions. It only has to be called by a sketch that changes the
+   * display buffer directly. Parts of the area outside the screen are
+   * ignored.
+   *
+   * \see markAllDirty() setDirtyTracking()
+   */
+  static void markDirty(int16_t x, int16_t y, int16_t w, int16_t h);
+
+  /** \brief
+   * Force the next `display()` to send the entire display buffer.
+   *
+   * \see markDirty() setDirtyTracking() setFrameDiffing()
+   */
+  static void markAllDirty();
+
+  /** \brief
+   * Get the number of bytes sent to the display by the last `display()`.
+   *
+   * \return The number of bytes of pixel data sent.
+   *
+   * \details
+   * A full update sends 102400 bytes. This can be used to measure the
+   * savings from using `setDirtyTracking()` or `setFrameDiffing()`.
+   *
+   * \see setDirtyTracking() setFrameDiffing()
+   */
+  uint32_t displayBytes();
+
   /** \brief
    * Set a single pixel in the display buffer to the specified color.
    *
@@ -627,9 +812,32 @@ class Arduboy2Base : public Arduboy2Core
    * \details
    * A triangle is drawn by specifying each of the three corner locations.
    * The corners can be at any position with respect to the others.
+   * The filled area includes the outline drawn by `drawTriangle()`.
+   *
+   * \see fillPolygon()
    */
   void fillTriangle (int16_t x0, int16_t y0, int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint8_t color = WHITE);
 
+  /** \brief
+   * Draw a filled-in polygon given the coordinates of its corners.
+   *
+   * \param points An array of the polygon's corners, in order around it.
+   * \param count The number of corners, up to `POLYGON_MAX_POINTS`.
+   * \param color The polygon's color (optional; defaults to WHITE).
+   *
+   * \details
+   * The polygon is closed by joining the last corner to the first. It can be
+   * convex or concave and its edges may cross. Areas enclosed by an odd
+   * number of edges are filled, and the edges themselves are drawn as by
+   * `drawLine()`.
+   *
+   * The polygon is filled in vertical runs of pixels, which suits the
+   * layout of the display buffer.
+   *
+   * \see fillTriangle() drawLine()
+   */
+  void fillPolygon(const Point points[], uint8_t count, uint8_t color = WHITE);
+
   /** \brief
    * Draw a bitmap from an array in program memory.
    *
@@ -707,9 +915,28 @@ class Arduboy2Base : public Arduboy2Core
    *
    * The input array must be located in program memory by declaring it as a
    * `const`.
+   *
+   * If `IMAGE_CACHE_BYTES` is set, the decoded image is kept in the
+   * `Arduboy2ImageCache` and drawn from there the next time the same array
+   * is drawn.
    */
   static void drawCompressed(int16_t sx, int16_t sy, const uint8_t *bitmap, uint8_t color = WHITE);
 
+  /** \brief
+   * Decode an array of compressed data into a bitmap.
+   *
+   * \param bitmap A pointer to the compressed bitmap array.
+   * \param image A pointer to a RAM buffer for the decoded bitmap.
+   *
+   * \details
+   * The bitmap is written in the format used by `drawBitmap()`, so the
+   * buffer must have room for the width of the image times its height in
+   * pages: `width * ((height + 7) / 8)` bytes.
+   *
+   * \see drawCompressed() Arduboy2ImageCache
+   */
+  static void decompress(const uint8_t *bitmap, uint8_t *image);
+
   /** \brief
    * Get a pointer to the display buffer in RAM.
    *
@@ -769,26 +996,36 @@ class Arduboy2Base : public Arduboy2Core
    * \details
    * Set the frame rate, in frames per second, used by `nextFrame()` to update
    * frames at a given rate. If this function or `setFrameDuration()`
-   * isn't used, the default rate will be 60 (actually 62.5, see note below).
+   * isn't used, the default rate will be 60.
    *
    * Normally, the frame rate would be set to the desired value once, at the
    * start of the game, but it can be changed at any time to alter the frame
    * update rate.
    *
    * \note
-   * \parblock
-   * The given rate is internally converted to a frame duration in milliseconds,
-   * rounded down to the nearest integer. Therefore, the actual rate will be
-   * equal to or higher than the rate given.
-
-   * For example, 60 FPS would be 16.67ms per frame. This will be rounded down
-   * to 16ms, giving an actual frame rate of 62.5 FPS.
-   * \endparblock
+   * Frames are timed in microseconds. When the frame duration isn't a whole
+   * number of microseconds the remainder is carried from frame to frame, so
+   * over time the rate is exact. For example, at 60 FPS two of every three
+   * frames are 16667us and the third is 16666us.
    *
-   * \see nextFrame() setFrameDuration()
+   * \see nextFrame() setFrameDuration() missedDeadlines()
    */
   void setFrameRate(uint8_t rate);
 
+  /** \brief
+   * Set a fractional frame rate used by the frame control functions.
+   *
+   * \param frames The number of frames.
+   * \param seconds The number of seconds in which `frames` frames are shown.
+   *
+   * \details
+   * The frame rate is `frames / seconds` frames per second. For example,
+   * `setFrameRate(60000, 1001)` gives the 59.94 FPS NTSC rate.
+   *
+   * \see setFrameRate(uint8_t) nextFrame()
+   */
+  void setFrameRate(uint32_t frames, uint32_t seconds);
+
   /** \brief
    * Set the frame rate, used by the frame control functions, by giving
    * the duration of each frame.
@@ -822,6 +1059,9 @@ class Arduboy2Base : public Arduboy2Core
    * which would wait for `true` to be returned before rendering and
    * displaying the next frame.
    *
+   * For the last millisecond before a frame is due this function waits
+   * until it is due and then returns `true`, so frames start on time.
+   *
    * example:
    * \code{.cpp}
    * void loop() {
@@ -898,10 +1138,28 @@ class Arduboy2Base : public Arduboy2Core
    * that the frame rate should be made slower or the frame processing code
    * should be optimized to run faster.
    *
-   * \see setFrameRate() nextFrame()
+   * For a breakdown of where the time goes, with cycle resolution, see
+   * the Arduboy2Profile class.
+   *
+   * \see setFrameRate() nextFrame() missedDeadlines() Arduboy2Profile
    */
   int cpuLoad();
 
+  /** \brief
+   * Get the number of frames that took longer than the time allotted.
+   *
+   * \return The number of frames, since the start of the sketch, that
+   * finished after the next frame was due.
+   *
+   * \details
+   * A frame is counted as missing its deadline if `nextFrame()` is first
+   * called after it finishes later than the time the next frame should
+   * start. The count wraps around to 0 after 65535.
+   *
+   * \see cpuLoad() setFrameRate() nextFrame()
+   */
+  uint16_t missedDeadlines();
+
   /** \brief
    * Test if the specified buttons are pressed.
    *
@@ -1292,7 +1550,26 @@ class Arduboy2Base : public Arduboy2Core
    *
    * \see getBuffer()
    */
-  static uint8_t sBuffer[(HEIGHT*WIDTH)/8];
+  static uint8_t sBuffer[(HEIGHT*WIDTH)/8] __attribute__ ((aligned (4)));
+
+#ifdef DISPLAY_GRAYSCALE
+  /** \brief
+   * The second plane of the display buffer in grayscale mode.
+   *
+   * \details
+   * When `DISPLAY_GRAYSCALE` is defined in `Arduboy2Core.h`, each pixel has
+   * a 2 bit color number made of its bit in `sBuffer` (bit 0) and its bit
+   * in `grayBuffer` (bit 1), in the same layout. The number selects a color
+   * set with `setGrayColor()`.
+   *
+   * The drawing functions only change `sBuffer`, so they draw in color 1
+   * (the pixel color) where `grayBuffer` is clear. The `Sprites` gray
+   * functions draw to both planes. Clearing the display buffer clears both.
+   *
+   * \see Sprites::drawGrayOverwrite() Sprites::drawGrayExternalMask()
+   */
+  static uint8_t grayBuffer[(HEIGHT*WIDTH)/8] __attribute__ ((aligned (4)));
+#endif
 
  protected:
   // helper function for sound enable/disable system control
@@ -1310,11 +1587,59 @@ class Arduboy2Base : public Arduboy2Core
   uint8_t currentButtonState;
   uint8_t previousButtonState;
 
-  // For frame funcions
-  uint8_t eachFrameMillis;
-  uint8_t thisFrameStart;
+  // For frame funcions. The frame period is eachFrameMicros plus
+  // frameRemainder / frameRateDivisor microseconds.
+  uint32_t eachFrameMicros;
+  uint32_t frameRemainder;
+  uint32_t frameRateDivisor;
+  uint32_t frameRemainderSum;
+  uint32_t nextFrameStart;
+  uint32_t thisFrameStart;
   bool justRendered;
-  uint8_t lastFrameDurationMs;
+  uint32_t lastFrameDurationUs;
+  uint16_t missedDeadlineCount;
+
+  // For dirty area tracking. For each page, the columns changed since the
+  // last display() and the columns that may contain set pixels. A span is
+  // empty when its start is not less than its end.
+  static bool dirtyTracking;
+  static uint8_t dirtyStart[HEIGHT/8];
+  static uint8_t dirtyEnd[HEIGHT/8];
+  static uint8_t inkStart[HEIGHT/8];
+  static uint8_t inkEnd[HEIGHT/8];
+
+  // Extend the dirty and ink spans of a page to include a column
+  static void markPixelColumn(uint8_t x, uint8_t page);
+  uint32_t lastDisplayBytes;
+
+  // For frame comparing. The last frame sent to the display, for each layer.
+  static bool frameDiffing;
+#ifdef FRAME_DIFFING
+  static uint8_t frameShadow[BUFFER_PLANES][(HEIGHT*WIDTH)/8] __attribute__ ((aligned (4)));
+#endif
+
+  // The buffers painted to the display: the layers, with the layer being
+  // drawn to always in sBuffer and the others in layerBuffer in any order,
+  // or sBuffer and grayBuffer.
+  static uint8_t *planeData[BUFFER_PLANES];
+#if PAINT_LAYERS > 0
+  static uint8_t layerBuffer[PAINT_LAYERS][(HEIGHT*WIDTH)/8] __attribute__ ((aligned (4)));
+  static uint8_t drawLayer;
+
+  // The ink spans of the layers not being drawn to
+  static uint8_t layerInkStart[PAINT_LAYERS + 1][HEIGHT/8];
+  static uint8_t layerInkEnd[PAINT_LAYERS + 1][HEIGHT/8];
+#endif
+
+  // Set by markAllDirty() to force the next display() to send everything
+  static bool fullDisplayPending;
+
+  // helpers for display() returning the number of bytes sent
+  uint32_t paintDirtySpans();
+#ifdef FRAME_DIFFING
+  uint32_t paintFrameChanges();
+#endif
+  static uint32_t paintArea(uint8_t x, uint8_t y, uint8_t width, uint8_t height);
 };
 
 
@@ -1460,6 +1785,24 @@ class Arduboy2 : public Print, public Arduboy2Base
    */
   virtual size_t write(uint8_t);
 
+  /** \brief
+   * Write a number of ASCII characters at the current text cursor location.
+   *
+   * \param buffer A pointer to the characters to be written.
+   * \param size The number of characters to write.
+   *
+   * \return The number of characters written (will always be `size`).
+   *
+   * \details
+   * This overrides the Arduino Print class `write()` for buffers, which is
+   * used by `print()` and `println()` for strings and numbers. Each character
+   * is handled the same as by `write(uint8_t)` but without a virtual function
+   * call per character.
+   *
+   * \see write(uint8_t) Print
+   */
+  virtual size_t write(const uint8_t *buffer, size_t size);
+
   /** \brief
    * Draw a single ASCII character at the specified location in the screen
    * buffer.
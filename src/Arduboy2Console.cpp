@@ -0,0 +1,215 @@
+/**
+ * @file Arduboy2Console.cpp
+ * \brief
+ * A character grid text console drawn into the Arduboy2 display buffer.
+ */
+
+#include "Arduboy2Console.h"
+
+// The pixel width of a character cell
+#define CELL_WIDTH 6
+
+// All of the column bits of a row in changed[]
+#define ALL_COLUMNS ((1UL << CONSOLE_COLUMNS) - 1)
+
+Arduboy2Console::Arduboy2Console(Arduboy2 &arduboy)
+  : arduboy(arduboy)
+{
+  memset(chars, ' ', sizeof(chars));
+  memset(attributes, CONSOLE_NORMAL, sizeof(attributes));
+  attribute = CONSOLE_NORMAL;
+  cursorColumn = 0;
+  cursorRow = 0;
+  scrollTop = 0;
+  scrollBottom = CONSOLE_ROWS - 1;
+  // the display buffer contents are unknown until the first render
+  invalidate();
+}
+
+void Arduboy2Console::clear()
+{
+  for (uint8_t row = 0; row < CONSOLE_ROWS; row++)
+  {
+    for (uint8_t column = 0; column < CONSOLE_COLUMNS; column++)
+    {
+      putChar(column, row, ' ', CONSOLE_NORMAL);
+    }
+  }
+  cursorColumn = 0;
+  cursorRow = 0;
+}
+
+void Arduboy2Console::render()
+{
+  for (uint8_t row = 0; row < CONSOLE_ROWS; row++)
+  {
+    uint32_t columns = changed[row];
+
+    for (uint8_t column = 0; columns; column++, columns >>= 1)
+    {
+      if (columns & 1)
+      {
+        const bool inverse = attributes[row][column] & CONSOLE_INVERSE;
+
+        arduboy.drawChar(column * CELL_WIDTH, row * 8, chars[row][column],
+                         inverse ? BLACK : WHITE, inverse ? WHITE : BLACK, 1);
+      }
+    }
+    changed[row] = 0;
+  }
+}
+
+void Arduboy2Console::invalidate()
+{
+  for (uint8_t row = 0; row < CONSOLE_ROWS; row++)
+  {
+    changed[row] = ALL_COLUMNS;
+  }
+}
+
+inline void Arduboy2Console::markCell(uint8_t column, uint8_t row)
+{
+  changed[row] |= 1UL << column;
+}
+
+void Arduboy2Console::putChar(uint8_t column, uint8_t row, uint8_t c, uint8_t attribute)
+{
+  if (column >= CONSOLE_COLUMNS || row >= CONSOLE_ROWS)
+  {
+    return;
+  }
+  if (chars[row][column] != c || attributes[row][column] != attribute)
+  {
+    chars[row][column] = c;
+    attributes[row][column] = attribute;
+    markCell(column, row);
+  }
+}
+
+uint8_t Arduboy2Console::getChar(uint8_t column, uint8_t row)
+{
+  return chars[row][column];
+}
+
+void Arduboy2Console::setAttribute(uint8_t attribute)
+{
+  this->attribute = attribute;
+}
+
+uint8_t Arduboy2Console::getAttribute()
+{
+  return attribute;
+}
+
+void Arduboy2Console::setCursor(uint8_t column, uint8_t row)
+{
+  cursorColumn = min(column, (uint8_t)(CONSOLE_COLUMNS - 1));
+  cursorRow = min(row, (uint8_t)(CONSOLE_ROWS - 1));
+}
+
+uint8_t Arduboy2Console::getCursorColumn()
+{
+  return cursorColumn;
+}
+
+uint8_t Arduboy2Console::getCursorRow()
+{
+  return cursorRow;
+}
+
+void Arduboy2Console::setScrollRegion(uint8_t top, uint8_t bottom)
+{
+  if (top <= bottom && bottom < CONSOLE_ROWS)
+  {
+    scrollTop = top;
+    scrollBottom = bottom;
+  }
+}
+
+void Arduboy2Console::scroll(int8_t lines)
+{
+  const uint8_t rows = scrollBottom - scrollTop + 1;
+  const bool up = lines > 0;
+  const uint8_t count = min((uint8_t)abs(lines), rows);
+  const uint8_t kept = rows - count;
+
+  if (count == 0)
+  {
+    return;
+  }
+
+  // Move the kept rows, in the order that doesn't overwrite rows still to
+  // be moved. A row's pixels move with its cells, so what was rendered stays
+  // valid and cells waiting to be rendered keep their changed bits.
+  for (uint8_t i = 0; i < kept; i++)
+  {
+    const uint8_t to = up ? scrollTop + i : scrollBottom - i;
+    const uint8_t from = up ? to + count : to - count;
+
+    memmove(chars[to], chars[from], CONSOLE_COLUMNS);
+    memmove(attributes[to], attributes[from], CONSOLE_COLUMNS);
+    changed[to] = changed[from];
+    memmove(arduboy.sBuffer + to * WIDTH, arduboy.sBuffer + from * WIDTH,
+            CONSOLE_COLUMNS * CELL_WIDTH);
+  }
+
+  // Blank the rows scrolled in. Spaces draw as all background, so the
+  // pixels can be cleared directly.
+  for (uint8_t i = 0; i < count; i++)
+  {
+    const uint8_t row = up ? scrollBottom - i : scrollTop + i;
+
+    memset(chars[row], ' ', CONSOLE_COLUMNS);
+    memset(attributes[row], CONSOLE_NORMAL, CONSOLE_COLUMNS);
+    changed[row] = 0;
+    memset(arduboy.sBuffer + row * WIDTH, 0, CONSOLE_COLUMNS * CELL_WIDTH);
+  }
+
+  Arduboy2Base::markDirty(0, scrollTop * 8, CONSOLE_COLUMNS * CELL_WIDTH, rows * 8);
+}
+
+void Arduboy2Console::newLine()
+{
+  cursorColumn = 0;
+  if (cursorRow == scrollBottom)
+  {
+    scroll(1);
+  }
+  else if (cursorRow < CONSOLE_ROWS - 1)
+  {
+    cursorRow++;
+  }
+}
+
+size_t Arduboy2Console::write(uint8_t c)
+{
+  if (c == '\n')
+  {
+    newLine();
+  }
+  else if (c == '\r')
+  {
+    cursorColumn = 0;
+  }
+  else
+  {
+    // wrap only when another character follows, so a full row followed by
+    // a newline doesn't leave an empty row
+    if (cursorColumn >= CONSOLE_COLUMNS)
+    {
+      newLine();
+    }
+    putChar(cursorColumn, cursorRow, c, attribute);
+    cursorColumn++;
+  }
+  return 1;
+}
+
+size_t Arduboy2Console::write(const uint8_t *buffer, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    Arduboy2Console::write(buffer[i]);
+  }
+  return size;
+}
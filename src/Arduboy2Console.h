@@ -0,0 +1,241 @@
+/**
+ * @file Arduboy2Console.h
+ * \brief
+ * A character grid text console drawn into the Arduboy2 display buffer.
+ */
+
+#ifndef ARDUBOY2_CONSOLE_H
+#define ARDUBOY2_CONSOLE_H
+
+#include "Arduboy2.h"
+
+#define CONSOLE_COLUMNS 21 /**< The number of character columns of the console. */
+#define CONSOLE_ROWS 8     /**< The number of character rows of the console. */
+
+#define CONSOLE_NORMAL 0x00  /**< Attribute for a white character on black. */
+#define CONSOLE_INVERSE 0x01 /**< Attribute for a black character on white. */
+
+/** \brief
+ * A text console that only redraws the characters that change.
+ *
+ * \details
+ * The console keeps a grid of `CONSOLE_COLUMNS` by `CONSOLE_ROWS` character
+ * cells, each holding a character code and an attribute, covering the
+ * display buffer in the standard 6 by 8 pixel text positions. Text is
+ * written to it using the Arduino Print class functions, the same as for
+ * `Arduboy2`, or placed directly in a cell with `putChar()`.
+ *
+ * Nothing is drawn until `render()` is called, usually just before
+ * `display()`. Only cells whose character or attribute has changed since
+ * they were last rendered are drawn, so a sketch that doesn't clear the
+ * display buffer each frame only pays for the text that changes. If the
+ * buffer is cleared or drawn over, `invalidate()` makes the next `render()`
+ * redraw every cell.
+ *
+ * A range of rows can be set as the scroll region. When a new line is
+ * started on the bottom row of the region, or `scroll()` is called, the rows
+ * of the region are moved by moving their pages of the display buffer
+ * instead of drawing their characters again.
+ *
+ * Example:
+ *
+ * \code{.cpp}
+ * #include <Arduboy2.h>
+ * #include <Arduboy2Console.h>
+ *
+ * Arduboy2 arduboy;
+ * Arduboy2Console console(arduboy);
+ *
+ * void setup() {
+ *   arduboy.begin();
+ *   arduboy.clear();
+ *   console.setAttribute(CONSOLE_INVERSE);
+ *   console.print(F("    Debug console    "));
+ *   console.setAttribute(CONSOLE_NORMAL);
+ *   console.setScrollRegion(1, CONSOLE_ROWS - 1);
+ *   console.setCursor(0, 1);
+ * }
+ *
+ * void loop() {
+ *   if (!arduboy.nextFrame()) {
+ *     return;
+ *   }
+ *   if (arduboy.everyXFrames(30)) {
+ *     console.println(millis());
+ *   }
+ *   console.render();
+ *   arduboy.display();
+ * }
+ * \endcode
+ *
+ * \see Arduboy2::drawChar()
+ */
+class Arduboy2Console : public Print
+{
+ public:
+  /** \brief
+   * Create a console that draws using the given `Arduboy2` object.
+   *
+   * \param arduboy The `Arduboy2` object to draw the characters with.
+   *
+   * \details
+   * All cells start as spaces with the `CONSOLE_NORMAL` attribute, which
+   * the first `render()` draws, and the scroll region is the whole console.
+   */
+  Arduboy2Console(Arduboy2 &arduboy);
+
+  /** \brief
+   * Fill the console with spaces and move the cursor to the top left.
+   *
+   * \details
+   * The current attribute isn't changed. Cells that weren't already spaces
+   * with the `CONSOLE_NORMAL` attribute are drawn by the next `render()`.
+   */
+  void clear();
+
+  /** \brief
+   * Draw the cells that have changed into the display buffer.
+   *
+   * \details
+   * The drawn area is marked dirty for the next `display()`.
+   *
+   * \see invalidate()
+   */
+  void render();
+
+  /** \brief
+   * Make the next `render()` draw every cell.
+   *
+   * \details
+   * This has to be called if the area of the display buffer used by the
+   * console has been cleared or drawn over since the last `render()`.
+   */
+  void invalidate();
+
+  /** \brief
+   * Set a cell's character and attribute.
+   *
+   * \param column The column of the cell, from 0 to `CONSOLE_COLUMNS - 1`.
+   * \param row The row of the cell, from 0 to `CONSOLE_ROWS - 1`.
+   * \param c The character code.
+   * \param attribute `CONSOLE_NORMAL` or `CONSOLE_INVERSE`.
+   *
+   * \details
+   * The cursor isn't moved. Cells outside the console are ignored.
+   */
+  void putChar(uint8_t column, uint8_t row, uint8_t c, uint8_t attribute = CONSOLE_NORMAL);
+
+  /** \brief
+   * Get the character code of a cell.
+   *
+   * \param column The column of the cell.
+   * \param row The row of the cell.
+   */
+  uint8_t getChar(uint8_t column, uint8_t row);
+
+  /** \brief
+   * Set the attribute of characters written from now on.
+   *
+   * \param attribute `CONSOLE_NORMAL` or `CONSOLE_INVERSE`.
+   */
+  void setAttribute(uint8_t attribute);
+
+  /** \brief
+   * Get the attribute of characters being written.
+   */
+  uint8_t getAttribute();
+
+  /** \brief
+   * Set the cell where the next character will be written.
+   *
+   * \param column The column, from 0 to `CONSOLE_COLUMNS - 1`.
+   * \param row The row, from 0 to `CONSOLE_ROWS - 1`.
+   */
+  void setCursor(uint8_t column, uint8_t row);
+
+  /** \brief
+   * Get the column where the next character will be written.
+   *
+   * \details
+   * After a character is written in the last column this will be
+   * `CONSOLE_COLUMNS`, until the next character starts a new line.
+   */
+  uint8_t getCursorColumn();
+
+  /** \brief
+   * Get the row where the next character will be written.
+   */
+  uint8_t getCursorRow();
+
+  /** \brief
+   * Set the rows that scroll.
+   *
+   * \param top The first row of the region.
+   * \param bottom The last row of the region.
+   *
+   * \details
+   * Starting a new line on the bottom row of the region scrolls the region
+   * up by one row. Rows outside the region are left alone. An invalid
+   * region is ignored.
+   *
+   * \see scroll()
+   */
+  void setScrollRegion(uint8_t top, uint8_t bottom);
+
+  /** \brief
+   * Scroll the scroll region by a number of rows.
+   *
+   * \param lines The number of rows to scroll. A positive number moves the
+   * contents up and a negative number moves them down.
+   *
+   * \details
+   * The rows scrolled in are filled with spaces with the `CONSOLE_NORMAL`
+   * attribute. The display buffer rows of the region are moved along with
+   * the cells, so cells that were already rendered aren't drawn again.
+   * The cursor isn't moved.
+   */
+  void scroll(int8_t lines);
+
+  /** \brief
+   * Write a character at the cursor and advance the cursor.
+   *
+   * \param c The character to be written.
+   *
+   * \return The number of characters written (will always be 1).
+   *
+   * \details
+   * The newline character `\n` moves the cursor to the start of the next row,
+   * scrolling if the cursor is on the bottom row of the scroll region. The
+   * carriage return character `\r` moves the cursor to the start of the
+   * current row. Writing past the last column wraps to the next row.
+   */
+  virtual size_t write(uint8_t c);
+
+  /** \brief
+   * Write a number of characters at the cursor.
+   *
+   * \param buffer A pointer to the characters to be written.
+   * \param size The number of characters to write.
+   *
+   * \return The number of characters written (will always be `size`).
+   */
+  virtual size_t write(const uint8_t *buffer, size_t size);
+
+  using Print::write;
+
+ protected:
+  void newLine();
+  void markCell(uint8_t column, uint8_t row);
+
+  Arduboy2 &arduboy;
+  uint8_t chars[CONSOLE_ROWS][CONSOLE_COLUMNS];
+  uint8_t attributes[CONSOLE_ROWS][CONSOLE_COLUMNS];
+  uint32_t changed[CONSOLE_ROWS]; // a bit for each column that needs drawing
+  uint8_t attribute;
+  uint8_t cursorColumn;
+  uint8_t cursorRow;
+  uint8_t scrollTop;
+  uint8_t scrollBottom;
+};
+
+#endif
@@ -9,35 +9,185 @@
 
 TFT_eSPI screen = TFT_eSPI();
 
+#ifdef DISPLAY_COLOR_444
+static uint16_t borderLineColor =  COLOR_GRAY;
+static uint16_t borderFillColor =  COLOR_BLACK;
+static uint16_t pixelColor = COLOR_WHITE;
+static uint16_t bgColor = COLOR_BLACK;
+#else
 static uint16_t borderLineColor =  TFT_LIGHTGREY;
 static uint16_t borderFillColor =  TFT_BLACK; 
 static uint16_t pixelColor = TFT_WHITE;
 static uint16_t bgColor = TFT_BLACK;
+#endif
 static uint8_t LEDs[] = {0, 0, 0};
+
+// The memory access control value set by setRotation(3) in bootDisplay().
+// flipVertical() and flipHorizontal() reverse the scan directions from it.
+static uint8_t MADCTL = TFT_MAD_MX | TFT_MAD_MY | TFT_MAD_MV | TFT_MAD_COLOR_ORDER;
 static bool inverted = false;
 static bool borderDrawn = false;
 const uint8_t borderInnerGap = 1;
 const uint8_t borderWindowWidth = WIDTH+borderInnerGap*2;
 const uint8_t borderWindowHeight = HEIGHT+borderInnerGap*2;
 
-#define BYTES_FOR_REGION(width, height) ((width)*(height)*12/8)  // 12 bits/px, 8 bits/byte
-static const int frameBufLen = BYTES_FOR_REGION(WIDTH, HEIGHT);
-static uint8_t frameBuf[frameBufLen];
+// Pixels are stored in pairs. See packPixels().
+#define PIXEL_PAIR_BYTES BYTES_FOR_REGION(2, 1)
+
+// The 128x64 buffer is scaled by 2.5 to S_WIDTH x S_HEIGHT using the same
+// columns and rows as nearest-neighbour sampling: even source columns (rows)
+// are repeated 3 times and odd ones 2 times.
+static_assert(S_WIDTH == WIDTH * 5 / 2 && S_HEIGHT == HEIGHT * 5 / 2,
+              "paintScreen() only supports a 2.5x scale");
+
+// Four source pixels expand to ten output pixels, stored as five packed
+// pixel pairs. Indexed by the four pixel bits, column 0 in bit 0.
+#define PAINT_GROUP_BYTES (PIXEL_PAIR_BYTES * 5)
+static uint8_t paintLUT[16][PAINT_GROUP_BYTES] __attribute__ ((aligned (4)));
+static bool paintLUTValid = false;
+
+#if PAINT_LAYERS > 0 || defined(DISPLAY_GRAYSCALE)
+// For images with a 2 bit color number for each pixel. Indexed by the four
+// low bits and four high bits, column 0 in bits 0 and 4.
+static uint8_t planeLUT[256][PAINT_GROUP_BYTES] __attribute__ ((aligned (4)));
+#endif
+
+#if PAINT_LAYERS > 0
+static_assert(PAINT_LAYERS <= 2, "PAINT_LAYERS must be 0, 1 or 2");
+
+// Each pixel of the combined layers is given a 2 bit number: 0 where no
+// layer is set, then 1 to 3 for the layer shown, from the highest priority
+// down.
+
+// Layer 0 uses pixelColor
+static uint16_t layerColor[PAINT_LAYERS + 1];
+static uint8_t layerPriority[PAINT_LAYERS + 1];
+
+// The layers from the highest priority to the lowest
+static uint8_t layerOrder[PAINT_LAYERS + 1];
+#endif
+
+#if PAINT_ATTRIBUTES > 0
+#if PAINT_LAYERS > 0
+#error "PAINT_ATTRIBUTES can't be used with PAINT_LAYERS"
+#endif
+static_assert(PAINT_ATTRIBUTES <= 256, "PAINT_ATTRIBUTES must be 256 or less");
+
+// The same as paintLUT for the colors of each attribute. Attribute 0, and
+// any attribute that hasn't been given colors, uses pixelColor and bgColor.
+static uint8_t attributeLUT[PAINT_ATTRIBUTES][16][PAINT_GROUP_BYTES] __attribute__ ((aligned (4)));
+static uint16_t attributeInk[PAINT_ATTRIBUTES];
+static uint16_t attributePaper[PAINT_ATTRIBUTES];
+static bool attributeColorsSet[PAINT_ATTRIBUTES];
+
+// Laid out like the display buffer with one byte per 8 columns, so the cell
+// of a buffer offset is the offset / 8
+static uint8_t cellAttributes[HEIGHT / 8][WIDTH / 8];
+#endif
+
+#ifdef PAINT_ROW_COLORS
+#if PAINT_LAYERS > 0 || PAINT_ATTRIBUTES > 0
+#error "PAINT_ROW_COLORS can't be used with PAINT_LAYERS or PAINT_ATTRIBUTES"
+#endif
+
+// A bit for each row that has its own colors
+static uint64_t rowColorsSet = 0;
+static_assert(HEIGHT <= 64, "PAINT_ROW_COLORS supports up to 64 rows");
+
+static uint16_t rowColors[HEIGHT][2]; // background, pixel
+
+// The same as paintLUT for the colors of the last row painted that had its
+// own colors, so runs of rows with the same colors only build it once
+static uint8_t rowLUT[16][PAINT_GROUP_BYTES] __attribute__ ((aligned (4)));
+static uint16_t rowLUTColors[2];
+static bool rowLUTValid = false;
+#endif
+
+#ifdef DISPLAY_GRAYSCALE
+#if PAINT_LAYERS > 0 || PAINT_ATTRIBUTES > 0 || defined(PAINT_ROW_COLORS)
+#error "DISPLAY_GRAYSCALE can't be used with PAINT_LAYERS, PAINT_ATTRIBUTES or PAINT_ROW_COLORS"
+#endif
+
+// Colors 2 and 3. Colors 0 and 1 are bgColor and pixelColor.
+static uint16_t grayColors[2];
+static bool grayColorSet[2] = { false, false };
+#endif
+
+// A fade between themes, with each color's start and end in the order of
+// Theme's members
+static uint16_t fadeFrom[4];
+static uint16_t fadeTo[4];
+static uint8_t fadeFrame = 0;
+static uint8_t fadeFrames = 0; // 0 when not fading
+
+// Set when the displayed frame no longer matches the last one painted, so
+// partial updates can't be used until the next full paintScreen().
+static bool fullPaintPending = true;
+
+// paintScreen() output is built and sent one band of PAINT_BAND_ROWS source
+// rows at a time. 32-bit storage keeps the buffers aligned for pushImage().
+#define PAINT_BAND_LINES (PAINT_BAND_ROWS * 5 / 2)
+static_assert(PAINT_BAND_ROWS % 2 == 0 && HEIGHT % PAINT_BAND_ROWS == 0,
+              "PAINT_BAND_ROWS must be even and divide HEIGHT");
+
+#ifdef DISPLAY_DMA
+// Bands alternate between two buffers, so the next band can be expanded
+// while DMA is still sending the previous one.
+#if PAINT_BAND_ROWS == HEIGHT
+#error "DISPLAY_DMA requires PAINT_BAND_ROWS to be smaller than HEIGHT"
+#endif
+#define PAINT_BUFFERS 2
+static bool dmaActive = false;
+#else
+#define PAINT_BUFFERS 1
+#endif
+
+static uint32_t paintBuf[PAINT_BUFFERS][BYTES_FOR_REGION(S_WIDTH, PAINT_BAND_LINES) / 4];
+static uint8_t paintBufIndex = 0;
 
 // Forward declarations
 
-static void drawRegion(uint16_t color, uint8_t x = (DISP_WIDTH-WIDTH)/2, uint8_t y = (DISP_HEIGHT-HEIGHT)/2, uint8_t width = WIDTH, uint8_t height = HEIGHT);
+static void drawRegion(uint16_t color, uint16_t x = (DISP_WIDTH-S_WIDTH)/2, uint16_t y = (DISP_HEIGHT-S_HEIGHT)/2, uint16_t width = S_WIDTH, uint16_t height = S_HEIGHT);
 
 static void drawBorder();
 static void drawBorderFill();
 static void drawBorderLines();
 static void drawBorderGap();
 static void drawLEDs();
+static void sendMADCTL();
+static uint16_t colorFromRGB(uint8_t red, uint8_t green, uint8_t blue);
+static uint16_t blendColors(uint16_t from, uint16_t to, uint8_t amount);
+static uint16_t colorFrom444(uint16_t color);
+static void getThemeColors(Theme theme, uint16_t *colors);
+static void setThemeColors(const uint16_t *colors);
+static void stepThemeFade();
+static inline uint8_t *packPixels(uint8_t *out, uint16_t color0, uint16_t color1);
+static void buildLUT(uint8_t (*lut)[PAINT_GROUP_BYTES], const uint16_t *palette, uint8_t bits);
+static void buildPaintLUT();
+
+// Expands one pixel row of the planes of an image into an output line
+typedef void (*ExpandRowFunction)(const uint8_t *const planes[], uint16_t offset, uint8_t shift, uint8_t width, uint8_t *line);
+
+static void expandRow(const uint8_t *const planes[], uint16_t offset, uint8_t shift, uint8_t width, uint8_t *line);
+#if PAINT_ATTRIBUTES > 0
+static void expandAttributeRow(const uint8_t *const planes[], uint16_t offset, uint8_t shift, uint8_t width, uint8_t *line);
+#endif
+#ifdef DISPLAY_GRAYSCALE
+static void expandGrayRow(const uint8_t *const planes[], uint16_t offset, uint8_t shift, uint8_t width, uint8_t *line);
+#endif
+#if PAINT_LAYERS > 0
+static void expandLayerRow(const uint8_t *const planes[], uint16_t offset, uint8_t shift, uint8_t width, uint8_t *line);
+#endif
+static void expandRows(const uint8_t *const planes[], ExpandRowFunction expand, uint8_t y, uint8_t rows, uint8_t x, uint8_t width, uint8_t *line);
+static uint32_t paintArea(const uint8_t *const planes[], ExpandRowFunction expand, uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+static uint8_t *nextPaintBuf();
+static void sendPixels(int16_t x, int16_t y, int16_t width, int16_t height, uint8_t *pixels);
 
 Arduboy2Core::Arduboy2Core() { }
 
 void Arduboy2Core::boot()
 {
+  Arduboy2Profile::begin();
   bootPins();
   bootDisplay();
 }
@@ -61,6 +211,9 @@ void Arduboy2Core::bootDisplay()
   delay(200);
   screen.setRotation(3);
   screen.fillScreen(TFT_BLACK);
+#ifdef DISPLAY_DMA
+  screen.initDMA();
+#endif
   delayShort(100);
   //drawBorder();
 }
@@ -80,12 +233,14 @@ void Arduboy2Core::safeMode()
 // Shut down the display
 void Arduboy2Core::displayOff()
 {
+    waitDisplay();
     screen.writecommand(ILI9341_DISPOFF); 
 }
 
 // Restart the display after a displayOff()
 void Arduboy2Core::displayOn()
 {
+    waitDisplay();
     screen.writecommand(ILI9341_DISPON);
 }
 
@@ -100,6 +255,8 @@ uint16_t Arduboy2Core::getPixelColor()
 void Arduboy2Core::setPixelColor(uint16_t color)
 {
   pixelColor = color;
+  paintLUTValid = false;
+  fullPaintPending = true;
 }
 
 uint16_t Arduboy2Core::getBackgroundColor()
@@ -110,6 +267,8 @@ uint16_t Arduboy2Core::getBackgroundColor()
 void Arduboy2Core::setBackgroundColor(uint16_t color)
 {
   bgColor = color;
+  paintLUTValid = false;
+  fullPaintPending = true;
 
   if (borderDrawn) {
     drawBorderGap();
@@ -146,10 +305,39 @@ void Arduboy2Core::setBorderFillColor(uint16_t color)
 
 void Arduboy2Core::setColorTheme(Theme theme)
 {
-  setPixelColor(theme.pixelColor);
-  setBackgroundColor(theme.backgroundColor);
-  setBorderLineColor(theme.borderLineColor);
-  setBorderFillColor(theme.borderFillColor);
+  uint16_t colors[4];
+
+  getThemeColors(theme, colors);
+  fadeFrames = 0;
+  setThemeColors(colors);
+}
+
+void Arduboy2Core::fadeToTheme(Theme theme, uint8_t frames)
+{
+  if (frames == 0) {
+    setColorTheme(theme);
+    return;
+  }
+
+  fadeFrom[0] = pixelColor;
+  fadeFrom[1] = bgColor;
+  fadeFrom[2] = borderLineColor;
+  fadeFrom[3] = borderFillColor;
+  getThemeColors(theme, fadeTo);
+  fadeFrame = 0;
+  fadeFrames = frames;
+}
+
+void Arduboy2Core::fadeToBlack(uint8_t frames)
+{
+  const Theme black = { COLOR_BLACK, COLOR_BLACK, COLOR_BLACK, COLOR_BLACK };
+
+  fadeToTheme(black, frames);
+}
+
+bool Arduboy2Core::fading()
+{
+  return fadeFrames > 0;
 }
 
 void Arduboy2Core::scale(const uint8_t *image, uint16_t w1, uint16_t h1, uint8_t *scaledImage, uint16_t w2, uint16_t h2) 
@@ -187,113 +375,676 @@ void Arduboy2Core::paintScreen(const uint8_t *image)
 
 void Arduboy2Core::paintScreen(uint8_t image[], bool clear)
 {
+  stepThemeFade();
+  paintRegion(image, 0, 0, WIDTH, HEIGHT);
+  fullPaintPending = false;
 
-  static uint16_t frameBuf_1[WIDTH * HEIGHT];
-  static uint16_t xPos, yPos, addr;
-  static uint8_t pixel;
+  if (clear) {
+    memset(image, 0, WIDTH*HEIGHT/8);
+  }
+}
 
-  for (xPos = 0; xPos < WIDTH; xPos++) {
-    for (yPos = 0; yPos < HEIGHT; yPos++) {
-      if (!(yPos % 8)) {
-        pixel = image[xPos + (yPos >> 3) * WIDTH];
-      }
-      addr = yPos * WIDTH  + xPos;
-      
-      if (pixel & 0x01) {
-        frameBuf_1[addr] = pixelColor;
-      } else {
-        frameBuf_1[addr] = bgColor;
+uint32_t Arduboy2Core::paintRegion(const uint8_t image[], uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+  const uint8_t *const planes[] = { image };
+
+#if PAINT_ATTRIBUTES > 0
+  return paintArea(planes, expandAttributeRow, x, y, width, height);
+#else
+  return paintArea(planes, expandRow, x, y, width, height);
+#endif
+}
+
+#if PAINT_LAYERS > 0
+void Arduboy2Core::paintLayers(const uint8_t *const layers[])
+{
+  stepThemeFade();
+  paintLayerRegion(layers, 0, 0, WIDTH, HEIGHT);
+  fullPaintPending = false;
+}
+
+uint32_t Arduboy2Core::paintLayerRegion(const uint8_t *const layers[], uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+  return paintArea(layers, expandLayerRow, x, y, width, height);
+}
+
+uint16_t Arduboy2Core::getLayerColor(uint8_t layer)
+{
+  if (layer > PAINT_LAYERS) {
+    return 0;
+  }
+  return layer == 0 ? pixelColor : layerColor[layer];
+}
+
+void Arduboy2Core::setLayerColor(uint8_t layer, uint16_t color)
+{
+  if (layer == 0) {
+    setPixelColor(color);
+    return;
+  }
+  if (layer > PAINT_LAYERS) {
+    return;
+  }
+  layerColor[layer] = color;
+  paintLUTValid = false;
+  fullPaintPending = true;
+}
+
+uint8_t Arduboy2Core::getLayerPriority(uint8_t layer)
+{
+  if (layer > PAINT_LAYERS) {
+    return 0;
+  }
+  return layerPriority[layer];
+}
+
+void Arduboy2Core::setLayerPriority(uint8_t layer, uint8_t priority)
+{
+  if (layer > PAINT_LAYERS) {
+    return;
+  }
+  layerPriority[layer] = priority;
+  paintLUTValid = false;
+  fullPaintPending = true;
+}
+#endif
+
+#if PAINT_ATTRIBUTES > 0
+uint16_t Arduboy2Core::getAttributeInk(uint8_t attribute)
+{
+  if (attribute >= PAINT_ATTRIBUTES) {
+    return 0;
+  }
+  return attributeColorsSet[attribute] ? attributeInk[attribute] : pixelColor;
+}
+
+uint16_t Arduboy2Core::getAttributePaper(uint8_t attribute)
+{
+  if (attribute >= PAINT_ATTRIBUTES) {
+    return 0;
+  }
+  return attributeColorsSet[attribute] ? attributePaper[attribute] : bgColor;
+}
+
+void Arduboy2Core::setAttributeColors(uint8_t attribute, uint16_t ink, uint16_t paper)
+{
+  if (attribute == 0) {
+    setPixelColor(ink);
+    setBackgroundColor(paper);
+    return;
+  }
+  if (attribute >= PAINT_ATTRIBUTES) {
+    return;
+  }
+  attributeInk[attribute] = ink;
+  attributePaper[attribute] = paper;
+  attributeColorsSet[attribute] = true;
+
+  const uint16_t colors[] = { paper, ink };
+  buildLUT(attributeLUT[attribute], colors, 1);
+  fullPaintPending = true;
+}
+
+uint8_t Arduboy2Core::getCellAttribute(uint8_t column, uint8_t row)
+{
+  return cellAttributes[row][column];
+}
+
+void Arduboy2Core::setCellAttribute(uint8_t column, uint8_t row, uint8_t attribute)
+{
+  if (column >= WIDTH / 8 || row >= HEIGHT / 8 || attribute >= PAINT_ATTRIBUTES) {
+    return;
+  }
+  if (cellAttributes[row][column] != attribute) {
+    cellAttributes[row][column] = attribute;
+    fullPaintPending = true;
+  }
+}
+
+void Arduboy2Core::clearCellAttributes()
+{
+  memset(cellAttributes, 0, sizeof(cellAttributes));
+  fullPaintPending = true;
+}
+#endif
+
+#ifdef DISPLAY_GRAYSCALE
+void Arduboy2Core::paintGrayScreen(const uint8_t *const planes[])
+{
+  stepThemeFade();
+  paintGrayRegion(planes, 0, 0, WIDTH, HEIGHT);
+  fullPaintPending = false;
+}
+
+uint32_t Arduboy2Core::paintGrayRegion(const uint8_t *const planes[], uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+  return paintArea(planes, expandGrayRow, x, y, width, height);
+}
+
+uint16_t Arduboy2Core::getGrayColor(uint8_t number)
+{
+  switch (number) {
+    case 0:
+      return bgColor;
+    case 1:
+      return pixelColor;
+    case 2:
+    case 3:
+      number -= 2;
+      // a third and two thirds of the way from the background color
+      return grayColorSet[number] ? grayColors[number] :
+             blendColors(bgColor, pixelColor, number == 0 ? 85 : 170);
+    default:
+      return 0;
+  }
+}
+
+void Arduboy2Core::setGrayColor(uint8_t number, uint16_t color)
+{
+  switch (number) {
+    case 0:
+      setBackgroundColor(color);
+      break;
+    case 1:
+      setPixelColor(color);
+      break;
+    case 2:
+    case 3:
+      grayColors[number - 2] = color;
+      grayColorSet[number - 2] = true;
+      paintLUTValid = false;
+      fullPaintPending = true;
+      break;
+  }
+}
+
+void Arduboy2Core::resetGrayColors()
+{
+  grayColorSet[0] = false;
+  grayColorSet[1] = false;
+  paintLUTValid = false;
+  fullPaintPending = true;
+}
+#endif
+
+#ifdef PAINT_ROW_COLORS
+void Arduboy2Core::setRowColors(uint8_t row, uint16_t color, uint16_t bgColor)
+{
+  if (row >= HEIGHT) {
+    return;
+  }
+  if ((rowColorsSet & (1ULL << row)) &&
+      rowColors[row][0] == bgColor && rowColors[row][1] == color) {
+    return;
+  }
+  rowColors[row][0] = bgColor;
+  rowColors[row][1] = color;
+  rowColorsSet |= 1ULL << row;
+  fullPaintPending = true;
+}
+
+uint16_t Arduboy2Core::getRowColor(uint8_t row)
+{
+  return (rowColorsSet & (1ULL << row)) ? rowColors[row][1] : pixelColor;
+}
+
+uint16_t Arduboy2Core::getRowBackgroundColor(uint8_t row)
+{
+  return (rowColorsSet & (1ULL << row)) ? rowColors[row][0] : bgColor;
+}
+
+void Arduboy2Core::clearRowColors(uint8_t row)
+{
+  if (rowColorsSet & (1ULL << row)) {
+    rowColorsSet &= ~(1ULL << row);
+    fullPaintPending = true;
+  }
+}
+
+void Arduboy2Core::clearRowColors()
+{
+  if (rowColorsSet) {
+    rowColorsSet = 0;
+    fullPaintPending = true;
+  }
+}
+
+// Get the lookup table for the colors of a row
+static const uint8_t (*rowColorLUT(uint8_t row))[PAINT_GROUP_BYTES]
+{
+  if (!(rowColorsSet & (1ULL << row))) {
+    return paintLUT;
+  }
+
+  const uint16_t *colors = rowColors[row];
+  if (!rowLUTValid || colors[0] != rowLUTColors[0] || colors[1] != rowLUTColors[1]) {
+    buildLUT(rowLUT, colors, 1);
+    rowLUTColors[0] = colors[0];
+    rowLUTColors[1] = colors[1];
+    rowLUTValid = true;
+  }
+  return rowLUT;
+}
+#endif
+
+// Paint an area of the planes of an image, expanding each row with `expand`
+static uint32_t paintArea(const uint8_t *const planes[], ExpandRowFunction expand, uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+  // widen to whole groups of 4 columns and pairs of rows, which map onto
+  // whole scaled pixels
+  const uint8_t x0 = x & ~3;
+  const uint8_t x1 = min((x + width + 3) & ~3, WIDTH);
+  const uint8_t y0 = y & ~1;
+  const uint8_t y1 = min((y + height + 1) & ~1, HEIGHT);
+
+  if (x0 >= x1 || y0 >= y1) {
+    return 0;
+  }
+
+  if (!paintLUTValid) {
+    buildPaintLUT();
+  }
+
+  const uint16_t outWidth = (x1 - x0) * 5 / 2;
+
+  for (uint8_t row = y0; row < y1; row += PAINT_BAND_ROWS) {
+    const uint8_t rows = min(PAINT_BAND_ROWS, y1 - row);
+    uint8_t *band = nextPaintBuf();
+    expandRows(planes, expand, row, rows, x0, x1 - x0, band);
+    sendPixels((DISP_WIDTH - S_WIDTH)/2 + x0*5/2, (DISP_HEIGHT - S_HEIGHT)/2 + row*5/2,
+               outWidth, rows*5/2, band);
+  }
+
+  return BYTES_FOR_REGION(outWidth, (y1 - y0) * 5 / 2);
+}
+
+bool Arduboy2Core::fullPaintNeeded()
+{
+  return fullPaintPending || fadeFrames > 0;
+}
+
+bool Arduboy2Core::displayBusy()
+{
+#ifdef DISPLAY_DMA
+  if (dmaActive && !screen.dmaBusy()) {
+    waitDisplay();
+  }
+  return dmaActive;
+#else
+  return false;
+#endif
+}
+
+void Arduboy2Core::waitDisplay()
+{
+#ifdef DISPLAY_DMA
+  if (dmaActive) {
+    PROFILE_SCOPE(PROFILE_SPI);
+    screen.dmaWait();
+    screen.endWrite();
+    dmaActive = false;
+  }
+#endif
+}
+
+// Convert a color value to the RGB565 pixels sent to the display
+static inline uint16_t displayColor(uint16_t color)
+{
+#ifdef DISPLAY_COLOR_444
+  // repeat the top bits of each channel to fill the wider fields
+  const uint16_t r = (color >> 8) & 0x0F;
+  const uint16_t g = (color >> 4) & 0x0F;
+  const uint16_t b = color & 0x0F;
+
+  return (((r << 1) | (r >> 3)) << 11) | (((g << 2) | (g >> 2)) << 5) |
+         ((b << 1) | (b >> 3));
+#else
+  return color;
+#endif
+}
+
+// Store two pixels as the 16-bit values pushImage() sends and return the
+// position after them
+static inline uint8_t *packPixels(uint8_t *out, uint16_t color0, uint16_t color1)
+{
+  const uint32_t pair = displayColor(color0) | ((uint32_t)displayColor(color1) << 16);
+  memcpy(out, &pair, 4);
+  return out + PIXEL_PAIR_BYTES;
+}
+
+static uint16_t colorFromRGB(uint8_t red, uint8_t green, uint8_t blue)
+{
+#ifdef DISPLAY_COLOR_444
+  return color444::from8BitRGB(red, green, blue);
+#else
+  return screen.color565(red, green, blue);
+#endif
+}
+
+// Convert a 12-bit 444-formatted color to the display's format
+static uint16_t colorFrom444(uint16_t color)
+{
+  // 17 scales each 4 bit channel to 8 bits exactly
+  return colorFromRGB(((color >> 8) & 0x0F) * 17, ((color >> 4) & 0x0F) * 17,
+                      (color & 0x0F) * 17);
+}
+
+// Get the colors of a theme in the display's format, in the order of
+// Theme's members
+static void getThemeColors(Theme theme, uint16_t *colors)
+{
+  colors[0] = colorFrom444(theme.pixelColor);
+  colors[1] = colorFrom444(theme.backgroundColor);
+  colors[2] = colorFrom444(theme.borderLineColor);
+  colors[3] = colorFrom444(theme.borderFillColor);
+}
+
+// Only the colors that change are set, so a fade step doesn't repaint parts
+// of the border that stay the same color.
+static void setThemeColors(const uint16_t *colors)
+{
+  if (colors[0] != pixelColor) {
+    Arduboy2Core::setPixelColor(colors[0]);
+  }
+  if (colors[1] != bgColor) {
+    Arduboy2Core::setBackgroundColor(colors[1]);
+  }
+  if (colors[2] != borderLineColor) {
+    Arduboy2Core::setBorderLineColor(colors[2]);
+  }
+  if (colors[3] != borderFillColor) {
+    Arduboy2Core::setBorderFillColor(colors[3]);
+  }
+}
+
+// Move a fade one frame on, before the whole display is painted. The last
+// step mixes in all of the end colors, so the fade ends exactly on them.
+static void stepThemeFade()
+{
+  if (fadeFrames == 0) {
+    return;
+  }
+
+  fadeFrame++;
+  const uint8_t amount = (uint16_t)fadeFrame * 255 / fadeFrames;
+  uint16_t colors[4];
+
+  for (uint8_t i = 0; i < 4; i++) {
+    colors[i] = blendColors(fadeFrom[i], fadeTo[i], amount);
+  }
+  if (fadeFrame == fadeFrames) {
+    fadeFrames = 0;
+  }
+  setThemeColors(colors);
+}
+
+// Mix two colors, from all of `from` (amount 0) to all of `to` (amount 255)
+static uint16_t blendColors(uint16_t from, uint16_t to, uint8_t amount)
+{
+#ifdef DISPLAY_COLOR_444
+  static const uint16_t fields[] = { 0x0F00, 0x00F0, 0x000F };
+#else
+  static const uint16_t fields[] = { 0xF800, 0x07E0, 0x001F };
+#endif
+  uint16_t color = 0;
+
+  for (uint8_t i = 0; i < 3; i++) {
+    const int32_t a = from & fields[i];
+    const int32_t b = to & fields[i];
+    color |= (a + (b - a) * amount / 255) & fields[i];
+  }
+  return color;
+}
+
+// Fill in a lookup table for groups of 4 pixels whose colors are chosen
+// from `palette` by a number of `bits` (1 or 2) bits. Bit 0 of the number
+// for column n is bit n of the index and bit 1 is bit n + 4.
+static void buildLUT(uint8_t (*lut)[PAINT_GROUP_BYTES], const uint16_t *palette, uint8_t bits)
+{
+  const uint8_t colors = 1 << bits;
+  uint8_t pairs[4][4][PIXEL_PAIR_BYTES];
+
+  for (uint8_t a = 0; a < colors; a++) {
+    for (uint8_t b = 0; b < colors; b++) {
+      packPixels(pairs[a][b], palette[a], palette[b]);
+    }
+  }
+
+  for (uint16_t i = 0; i < (1 << (bits * 4)); i++) {
+    const uint8_t c0 = (i & 0x1) | ((i >> 3) & 0x2);
+    const uint8_t c1 = ((i >> 1) & 0x1) | ((i >> 4) & 0x2);
+    const uint8_t c2 = ((i >> 2) & 0x1) | ((i >> 5) & 0x2);
+    const uint8_t c3 = ((i >> 3) & 0x1) | ((i >> 6) & 0x2);
+
+    // column pattern 3,2,3,2 -> c0 c0 | c0 c1 | c1 c2 | c2 c2 | c3 c3
+    uint8_t *out = lut[i];
+    memcpy(out, pairs[c0][c0], PIXEL_PAIR_BYTES);
+    memcpy(out + PIXEL_PAIR_BYTES, pairs[c0][c1], PIXEL_PAIR_BYTES);
+    memcpy(out + PIXEL_PAIR_BYTES * 2, pairs[c1][c2], PIXEL_PAIR_BYTES);
+    memcpy(out + PIXEL_PAIR_BYTES * 3, pairs[c2][c2], PIXEL_PAIR_BYTES);
+    memcpy(out + PIXEL_PAIR_BYTES * 4, pairs[c3][c3], PIXEL_PAIR_BYTES);
+  }
+}
+
+static void buildPaintLUT()
+{
+  const uint16_t mono[] = { bgColor, pixelColor };
+  buildLUT(paintLUT, mono, 1);
+#if PAINT_ATTRIBUTES > 0
+  for (uint16_t attribute = 0; attribute < PAINT_ATTRIBUTES; attribute++) {
+    if (!attributeColorsSet[attribute]) {
+      memcpy(attributeLUT[attribute], paintLUT, sizeof(paintLUT));
+    }
+  }
+#endif
+
+#if PAINT_LAYERS > 0
+  // sort the layers by priority, then by number, lowest number on top
+  for (uint8_t i = 0; i <= PAINT_LAYERS; i++) {
+    uint8_t rank = 0;
+    for (uint8_t j = 0; j <= PAINT_LAYERS; j++) {
+      if (layerPriority[j] > layerPriority[i] ||
+          (layerPriority[j] == layerPriority[i] && j < i)) {
+        rank++;
       }
-      
-      pixel = pixel >> 1;
     }
+    layerOrder[rank] = i;
   }
 
-  static uint16_t scaledImage[S_WIDTH * S_HEIGHT] = {0};
-  uint16_t x2, y2;
-  uint16_t x_ratio = (uint16_t)((WIDTH<<16)/S_WIDTH) + 1;
-  uint16_t y_ratio = (uint16_t)((HEIGHT<<16)/S_HEIGHT) + 1;
+  uint16_t palette[4] = { bgColor, bgColor, bgColor, bgColor };
+  for (uint8_t rank = 0; rank <= PAINT_LAYERS; rank++) {
+    palette[rank + 1] = Arduboy2Core::getLayerColor(layerOrder[rank]);
+  }
+  buildLUT(planeLUT, palette, 2);
+#endif
 
-  for (uint16_t i = 0; i < S_HEIGHT; i++) {
-      for (uint16_t j = 0; j < S_WIDTH; j++) {
-          x2 = ((j * x_ratio) >> 16) ;
-          y2 = ((i * y_ratio) >> 16) ;
-          scaledImage[(i * S_WIDTH) + j] = frameBuf_1[(y2 * WIDTH) + x2] ;
-      }                
-  }                
-  
-  //screen.pushImage((DISP_WIDTH-WIDTH)/2,(DISP_HEIGHT-HEIGHT)/2, WIDTH, HEIGHT, frameBuf_1);
-  screen.pushImage((DISP_WIDTH - S_WIDTH)/2,(DISP_HEIGHT - S_HEIGHT)/2, S_WIDTH, S_HEIGHT, scaledImage);
+#ifdef DISPLAY_GRAYSCALE
+  uint16_t grays[4];
+  for (uint8_t number = 0; number < 4; number++) {
+    grays[number] = Arduboy2Core::getGrayColor(number);
+  }
+  buildLUT(planeLUT, grays, 2);
+#endif
 
-  if (clear) {
-    memset(image, 0, WIDTH*HEIGHT/8);
+  paintLUTValid = true;
+}
+
+// Gather bit `shift` of the 4 bytes of `cols` into bits 0-3
+static inline uint8_t gatherBits(uint32_t cols, uint8_t shift)
+{
+  return (((cols >> shift) & 0x01010101) * 0x10204080) >> 28;
+}
+
+// Expand one pixel row (bit `shift` of `width` bytes starting at `offset`)
+// into an output line of width * 2.5 pixels. `width` must be a multiple
+// of 4.
+static void expandRow(const uint8_t *const planes[], uint16_t offset, uint8_t shift, uint8_t width, uint8_t *line)
+{
+  const uint8_t *page = planes[0] + offset;
+#ifdef PAINT_ROW_COLORS
+  const uint8_t (*lut)[PAINT_GROUP_BYTES] = rowColorLUT(offset / WIDTH * 8 + shift);
+#else
+  const uint8_t (*lut)[PAINT_GROUP_BYTES] = paintLUT;
+#endif
+
+  for (const uint8_t *end = page + width; page < end; page += 4) {
+    uint32_t cols;
+    memcpy(&cols, page, 4);
+
+    memcpy(line, lut[gatherBits(cols, shift)], PAINT_GROUP_BYTES);
+    line += PAINT_GROUP_BYTES;
   }
 }
 
-/*void Arduboy2Core::paintScreen(uint8_t image[], bool clear)
+#if PAINT_ATTRIBUTES > 0
+// The same as expandRow(), using the table of each group's cell
+static void expandAttributeRow(const uint8_t *const planes[], uint16_t offset, uint8_t shift, uint8_t width, uint8_t *line)
 {
-  int b = 0;
-  for (int y = 0; y < HEIGHT; y++)
-  {
-    int row = y >> 3;  // y / 8
-    uint8_t rowMask = bit(y & 0x7);  // y % 8
-    for (int x = 0; x < WIDTH; x += 2)
-    {
-      // Read next 2 pixels
-      uint8_t *img = image + (x + row*WIDTH);
-      uint16_t p0 = (img[0] & rowMask) ? pixelColor : bgColor;
-      uint16_t p1 = (img[1] & rowMask) ? pixelColor : bgColor;
-
-      // Write both as 12-bit pixels (3 bytes)
-      frameBuf[b++] = p0 >> 4;
-      frameBuf[b++] = ((p0 & 0xF) << 4) | (p1 >> 8);
-      frameBuf[b++] = p1;
-      //frameBuf[row * WIDTH + x] = p0 >> 4;
-      //frameBuf[row * WIDTH + x + 1] = ((p0 & 0xF) << 4) | (p1 >> 8);
-      //frameBuf[row * WIDTH + x + 2] = p1;
+  const uint8_t *page = planes[0] + offset;
+  const uint8_t *cells = cellAttributes[0];
+
+  for (uint16_t end = offset + width; offset < end; offset += 4) {
+    uint32_t cols;
+    memcpy(&cols, page, 4);
+    page += 4;
+
+    memcpy(line, attributeLUT[cells[offset >> 3]][gatherBits(cols, shift)], PAINT_GROUP_BYTES);
+    line += PAINT_GROUP_BYTES;
+  }
+}
+#endif
+
+#ifdef DISPLAY_GRAYSCALE
+// The same as expandRow() for the two planes of a grayscale image
+static void expandGrayRow(const uint8_t *const planes[], uint16_t offset, uint8_t shift, uint8_t width, uint8_t *line)
+{
+  const uint8_t *low = planes[0] + offset;
+  const uint8_t *high = planes[1] + offset;
+
+  for (uint8_t i = 0; i < width; i += 4) {
+    uint32_t l, h;
+    memcpy(&l, low + i, 4);
+    memcpy(&h, high + i, 4);
+
+    memcpy(line, planeLUT[gatherBits(l, shift) | (gatherBits(h, shift) << 4)], PAINT_GROUP_BYTES);
+    line += PAINT_GROUP_BYTES;
+  }
+}
+#endif
+
+#if PAINT_LAYERS > 0
+// The same as expandRow() for the combined layers. The pixels each layer
+// shows are masked out of the layers below it 4 columns at a time.
+static void expandLayerRow(const uint8_t *const planes[], uint16_t offset, uint8_t shift, uint8_t width, uint8_t *line)
+{
+  const uint8_t *top = planes[layerOrder[0]] + offset;
+  const uint8_t *middle = planes[layerOrder[1]] + offset;
+#if PAINT_LAYERS == 2
+  const uint8_t *bottom = planes[layerOrder[2]] + offset;
+#endif
+
+  for (uint8_t i = 0; i < width; i += 4) {
+    uint32_t t, m;
+    memcpy(&t, top + i, 4);
+    memcpy(&m, middle + i, 4);
+
+#if PAINT_LAYERS == 2
+    uint32_t b;
+    memcpy(&b, bottom + i, 4);
+    b &= ~(t | m);
+    const uint32_t low = t | b;
+    const uint32_t high = (m & ~t) | b;
+#else
+    const uint32_t low = t;
+    const uint32_t high = m & ~t;
+#endif
+
+    memcpy(line, planeLUT[gatherBits(low, shift) | (gatherBits(high, shift) << 4)], PAINT_GROUP_BYTES);
+    line += PAINT_GROUP_BYTES;
+  }
+}
+#endif
+
+// Expand `rows` pixel rows starting at row `y` (which must be even) and
+// column `x` into consecutive scaled output lines.
+static void expandRows(const uint8_t *const planes[], ExpandRowFunction expand, uint8_t y, uint8_t rows, uint8_t x, uint8_t width, uint8_t *line)
+{
+  PROFILE_SCOPE(PROFILE_PAINT);
+  const uint16_t lineBytes = width / 4 * PAINT_GROUP_BYTES;
+
+  for (const uint8_t end = y + rows; y < end; y++) {
+    expand(planes, (y >> 3) * WIDTH + x, y & 7, width, line);
+
+    // even source rows become 3 output lines, odd rows 2
+    uint8_t *copy = line + lineBytes;
+    memcpy(copy, line, lineBytes);
+    if (!(y & 1)) {
+      copy += lineBytes;
+      memcpy(copy, line, lineBytes);
     }
+    line = copy + lineBytes;
   }
+}
 
-  screen.pushImage((DISP_WIDTH-HEIGHT)/2, (DISP_HEIGHT-WIDTH)/2, HEIGHT, WIDTH, frameBuf);
+static uint8_t *nextPaintBuf()
+{
+#if PAINT_BUFFERS > 1
+  paintBufIndex = (paintBufIndex + 1) % PAINT_BUFFERS;
+#endif
+  return (uint8_t *)paintBuf[paintBufIndex];
+}
 
-  if (clear) {
-    memset(image, 0, WIDTH*HEIGHT/8);
+// Send a rectangle of pixels packed by packPixels(). With DISPLAY_DMA this
+// only waits for the previous transfer and starts a new one, leaving the SPI
+// transaction open until waitDisplay().
+static void sendPixels(int16_t x, int16_t y, int16_t width, int16_t height, uint8_t *pixels)
+{
+  PROFILE_SCOPE(PROFILE_SPI);
+#if defined(DISPLAY_DMA)
+  if (!dmaActive) {
+    screen.startWrite();
+    dmaActive = true;
   }
-}*/
+  screen.dmaWait();
+  screen.pushImageDMA(x, y, width, height, (uint16_t *)pixels);
+#else
+  screen.pushImage(x, y, width, height, (uint16_t *)pixels);
+#endif
+}
 
 void Arduboy2Core::blank()
 {
+  fullPaintPending = true;
   drawRegion(bgColor);
 }
 
-static void drawRegion(uint16_t color, uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+// Fill a rectangle of the display with a single color. The color is
+// streamed to the display's window, so no frame buffer is needed.
+static void drawRegion(uint16_t color, uint16_t x, uint16_t y, uint16_t width, uint16_t height)
 {
-  int numBytes = BYTES_FOR_REGION(width, height);
-
-  for (int i = 0; i < numBytes; i += 3)
-  {
-    frameBuf[i] = color >> 4;
-    frameBuf[i+1] = ((color & 0xF) << 4) | (color >> 8);
-    frameBuf[i+2] = color;
+  if (width == 0 || height == 0) {
+    return;
   }
 
-  screen.pushImage(x, y,  width, height, frameBuf);
+  Arduboy2Core::waitDisplay();
+
+  screen.fillRect(x, y, width, height, displayColor(color));
 }
 
-static uint8_t borderMarginX()
+static uint16_t borderMarginX()
 {
   return (DISP_WIDTH-borderWindowWidth)/2;
 }
 
-static uint8_t borderMarginY()
+static uint16_t borderMarginY()
 {
   return (DISP_HEIGHT-borderWindowHeight)/2;
 }
 
 static void drawBorderFill()
 {
-  const uint8_t marginX = borderMarginX();
-  const uint8_t marginY = borderMarginY();
+  const uint16_t marginX = borderMarginX();
+  const uint16_t marginY = borderMarginY();
   drawRegion(borderFillColor, 0, 0, DISP_WIDTH, marginY-1);
   drawRegion(borderFillColor, 0, DISP_HEIGHT-(marginY-1), DISP_WIDTH, marginY-1);
   drawRegion(borderFillColor, 0, marginY-1, marginX-1, borderWindowHeight+4);
@@ -302,8 +1053,8 @@ static void drawBorderFill()
 
 static void drawBorderLines()
 {
-  const uint8_t marginX = borderMarginX();
-  const uint8_t marginY = borderMarginY();
+  const uint16_t marginX = borderMarginX();
+  const uint16_t marginY = borderMarginY();
   int numBytes;
 
   drawRegion(borderLineColor, marginX-1, marginY-1, borderWindowWidth+2, 1);
@@ -314,8 +1065,8 @@ static void drawBorderLines()
 
 static void drawBorderGap()
 {
-  const uint8_t marginX = borderMarginX();
-  const uint8_t marginY = borderMarginY();
+  const uint16_t marginX = borderMarginX();
+  const uint16_t marginY = borderMarginY();
   int numBytes;
 
   drawRegion(bgColor, marginX, marginY, borderWindowWidth, borderInnerGap);
@@ -359,20 +1110,21 @@ void Arduboy2Core::allPixelsOn(bool on)
  delayShort(100);
 }
 
+// The panel is used in landscape (MV set), so its column order (MX) runs
+// along the display's height and its row order (MY) along the width.
+
 // flip the display vertically or set to normal
 void Arduboy2Core::flipVertical(bool flipped)
 {
   if (flipped)
   {
-    //MADCTL |= ST77XX_MADCTL_MX;
+    MADCTL &= ~TFT_MAD_MX;
   }
   else
   {
-    //MADCTL &= ~ST77XX_MADCTL_MX;
+    MADCTL |= TFT_MAD_MX;
   }
-  //beginDisplaySPI();
-  //sendDisplayCommand(ST77XX_MADCTL);
-  //SPITransfer(MADCTL);
+  sendMADCTL();
 }
 
 // flip the display horizontally or set to normal
@@ -380,15 +1132,23 @@ void Arduboy2Core::flipHorizontal(bool flipped)
 {
   if (flipped)
   {
-    //MADCTL &= ~ST77XX_MADCTL_MY;
+    MADCTL &= ~TFT_MAD_MY;
   }
   else
   {
-    //MADCTL |= ST77XX_MADCTL_MY;
+    MADCTL |= TFT_MAD_MY;
   }
-  //beginDisplaySPI();
-  //sendDisplayCommand(ST77XX_MADCTL);
-  //SPITransfer(MADCTL);
+  sendMADCTL();
+}
+
+// The new scan direction only applies to pixels written after it is set,
+// so the next display() must repaint the whole screen.
+static void sendMADCTL()
+{
+  Arduboy2Core::waitDisplay();
+  screen.writecommand(TFT_MADCTL);
+  screen.writedata(MADCTL);
+  fullPaintPending = true;
 }
 
 
@@ -427,24 +1187,12 @@ void Arduboy2Core::digitalWriteRGB(uint8_t color, uint8_t val)
   drawLEDs();
 }
 
+// Show the RGB LED as a strip along the bottom of the display, which is
+// the top of the window when flipped vertically
 static void drawLEDs()
 {
-  //Arduboy2Core::beginDisplaySPI();
-
-  int numBytes = BYTES_FOR_REGION(DISP_WIDTH, 4);
-  //setWriteRegion(0, (MADCTL & ST77XX_MADCTL_MX) ? 0 : DISP_HEIGHT-4, DISP_WIDTH, 4);
-
-  for (int i = 0; i < numBytes; i += 3)
-  {
-    const uint16_t color = color444::from8BitRGB(LEDs[RED_LED], LEDs[GREEN_LED], LEDs[BLUE_LED]);
-
-    // Reuse frameBuf since numBytes should be less than frameBufLen
-    frameBuf[i] = color >> 4;
-    frameBuf[i + 1] = ((color & 0xF) << 4) | (color >> 8);
-    frameBuf[i + 2] = color;
-  }
-
-  //dispSPI.transfer(frameBuf, NULL, numBytes, false);
+  drawRegion(colorFromRGB(LEDs[RED_LED], LEDs[GREEN_LED], LEDs[BLUE_LED]),
+             0, (MADCTL & TFT_MAD_MX) ? DISP_HEIGHT-4 : 0, DISP_WIDTH, 4);
 }
 
 
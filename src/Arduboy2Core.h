@@ -10,6 +10,7 @@
 #include <Arduino.h>
 #include <TFT_eSPI.h>
 
+#include "Arduboy2Profile.h"
 #include "themes/themes.h"
 #include "themes/colors.h"
 
@@ -58,6 +59,75 @@
 #define DISP_WIDTH  320
 #define DISP_HEIGHT 240
 
+// The number of buffer rows paintScreen() scales and sends to the display in
+// each SPI transfer. It must be even and divide HEIGHT. Each row needs
+// S_WIDTH * 5 bytes of RAM (2.5 output lines of 2 byte pixels), so the
+// default of one 8 pixel page uses 12.5 KB. Setting it to HEIGHT scales
+// the whole frame before sending it, using 100 KB.
+#ifndef PAINT_BAND_ROWS
+#define PAINT_BAND_ROWS 8
+#endif
+
+// If defined, color values passed to setPixelColor() and the other color
+// functions are 12-bit 444-formatted, like those in colors.h and themes.h.
+// They're converted to RGB565 when the paint lookup tables are built, so the
+// display is still sent 16-bit pixels (the ILI9341 has no 12-bit mode on
+// its SPI interface). Otherwise they are RGB565 values.
+//#define DISPLAY_COLOR_444
+
+// The number of bytes sent to the display for a region of pixels
+#define BYTES_FOR_REGION(width, height) ((width)*(height)*2)  // 16 bits/px, 8 bits/byte
+
+// If defined, paintScreen() sends each band using SPI DMA and returns as
+// soon as the last band has been started, so the transfer overlaps with
+// the sketch's next frame. Two band buffers are used. This requires a
+// TFT_eSPI build with DMA support (initDMA() and pushImageDMA()).
+//#define DISPLAY_DMA
+
+// The number of layers display() combines with the display buffer, from 0
+// to 2. Each layer is another 1 KB buffer in the same format, drawn in its
+// own color, and where layers overlap the one with the highest priority is
+// shown, or the lowest numbered one if their priorities are the same. See
+// Arduboy2Base::setDrawLayer().
+#ifndef PAINT_LAYERS
+#define PAINT_LAYERS 0
+#endif
+
+// The number of color attributes, from 0 to 256. When set, each 8x8 cell of
+// the display can be given one of the attributes, and its pixels are drawn
+// in that attribute's ink and paper colors. Attributes without colors of
+// their own use the pixel and background colors. Each attribute uses about
+// 320 bytes of RAM. Can't be used with PAINT_LAYERS. See
+// Arduboy2Core::setCellAttribute().
+#ifndef PAINT_ATTRIBUTES
+#define PAINT_ATTRIBUTES 0
+#endif
+
+// If defined, each row of the display can be given its own pixel and
+// background colors with Arduboy2Core::setRowColors(), for gradients and
+// other raster effects that don't change the display buffer. Rows without
+// their own colors use the pixel and background colors. Can't be used with
+// PAINT_LAYERS or PAINT_ATTRIBUTES.
+//#define PAINT_ROW_COLORS
+
+// If defined, the display buffer has a second 1 KB plane and each pixel is
+// drawn in one of 4 colors, chosen by its bits in the two planes. See
+// Arduboy2Base::grayBuffer and Arduboy2Core::setGrayColor(). Can't be used
+// with PAINT_LAYERS, PAINT_ATTRIBUTES or PAINT_ROW_COLORS.
+//#define DISPLAY_GRAYSCALE
+
+// The number of 1 KB buffers painted to the display
+#ifdef DISPLAY_GRAYSCALE
+#define BUFFER_PLANES 2
+#else
+#define BUFFER_PLANES (PAINT_LAYERS + 1)
+#endif
+
+// If defined, Arduboy2Base::setFrameDiffing() can be used to only send the
+// parts of each frame that changed. It keeps a copy of the last frame sent,
+// which takes BUFFER_PLANES KB of RAM.
+//#define FRAME_DIFFING
+
 // ----- Pins -----
 
 #define PORT_ST_A_B   (&(PORT->Group[PORTC]))
@@ -229,7 +299,8 @@ class Arduboy2Core
      * Get the current display pixel color.
      *
      * \details
-     * Returns a 12-bit 444-formatted RGB color value.
+     * Returns an RGB565 color value, or a 12-bit 444-formatted RGB color
+     * value when `DISPLAY_COLOR_444` is defined.
      *
      * \see setPixelColor() getBorderLineColor() setBorderLineColor() getBorderFillColor() setBorderFillColor()
      * getBackgroundColor() setBackgroundColor() setColorTheme()
@@ -242,12 +313,14 @@ class Arduboy2Core
      * \param color The color to set.
      *
      * \details
-     * Color must be a 12-bit 444-formatted RGB color value. May be called before `begin()`
+     * Color must be an RGB565 color value, or a 12-bit 444-formatted RGB
+     * color value when `DISPLAY_COLOR_444` is defined. May be called before `begin()`
      * or `boot()`. Value will take effect on next call to `paintScreen()`.
      *
      * \note
-     * The file `colors.h` contains helpful utilities for creating 12-bit 444-formatted
-     * color values.
+     * The `TFT_` colors and `color565()` of TFT_eSPI give RGB565 values. The
+     * file `colors.h` contains helpful utilities for creating 12-bit
+     * 444-formatted color values.
      *
      * \see getPixelColor() getBorderLineColor() setBorderLineColor() getBorderFillColor()
      * setBorderFillColor() getBackgroundColor() setBackgroundColor() setColorTheme()
@@ -258,7 +331,8 @@ class Arduboy2Core
      * Get the current display background color.
      *
      * \details
-     * Returns a 12-bit 444-formatted RGB color value.
+     * Returns an RGB565 color value, or a 12-bit 444-formatted RGB color
+     * value when `DISPLAY_COLOR_444` is defined.
      *
      * \see setBackgroundColor() getPixelColor() setPixelColor() getBorderLineColor()
      * setBorderLineColor() getBorderFillColor() setBorderFillColor() setColorTheme()
@@ -272,12 +346,14 @@ class Arduboy2Core
      * \param color The color to set.
      *
      * \details
-     * Color must be a 12-bit 444-formatted RGB color value. May be called before `begin()`
+     * Color must be an RGB565 color value, or a 12-bit 444-formatted RGB
+     * color value when `DISPLAY_COLOR_444` is defined. May be called before `begin()`
      * or `boot()`. Value will take effect on next call to `paintScreen()`.
      *
      * \note
-     * The file `colors.h` contains helpful utilities for creating 12-bit 444-formatted
-     * color values.
+     * The `TFT_` colors and `color565()` of TFT_eSPI give RGB565 values. The
+     * file `colors.h` contains helpful utilities for creating 12-bit
+     * 444-formatted color values.
      *
      * \see getBackgroundColor() getPixelColor() setPixelColor() getBorderLineColor()
      * setBorderLineColor() getBorderFillColor() setBorderFillColor() setColorTheme()
@@ -288,7 +364,8 @@ class Arduboy2Core
      * Get the current display border line color.
      *
      * \details
-     * Returns a 12-bit 444-formatted RGB color value.
+     * Returns an RGB565 color value, or a 12-bit 444-formatted RGB color
+     * value when `DISPLAY_COLOR_444` is defined.
      *
      * \see setBorderLineColor() getBorderFillColor() setBorderFillColor() getPixelColor()
      * setPixelColor() getBackgroundColor() setBackgroundColor() setColorTheme()
@@ -301,12 +378,14 @@ class Arduboy2Core
      * \param color The color to set.
      *
      * \details
-     * Color must be a 12-bit 444-formatted RGB color value. May be called before `begin()`
+     * Color must be an RGB565 color value, or a 12-bit 444-formatted RGB
+     * color value when `DISPLAY_COLOR_444` is defined. May be called before `begin()`
      * or `boot()`.
      *
      * \note
-     * The file `colors.h` contains helpful utilities for creating 12-bit 444-formatted
-     * color values.
+     * The `TFT_` colors and `color565()` of TFT_eSPI give RGB565 values. The
+     * file `colors.h` contains helpful utilities for creating 12-bit
+     * 444-formatted color values.
      *
      * \see getBorderLineColor() getBorderFillColor() setBorderFillColor() getPixelColor()
      * setPixelColor() getBackgroundColor() setBackgroundColor() setColorTheme()
@@ -317,7 +396,8 @@ class Arduboy2Core
      * Get the current display border fill color.
      *
      * \details
-     * Returns a 12-bit 444-formatted RGB color value.
+     * Returns an RGB565 color value, or a 12-bit 444-formatted RGB color
+     * value when `DISPLAY_COLOR_444` is defined.
      *
      * \see setBorderFillColor() getBorderLineColor() setBorderLineColor() getPixelColor()
      * setPixelColor() getBackgroundColor() setBackgroundColor() setColorTheme()
@@ -330,12 +410,14 @@ class Arduboy2Core
      * \param color The color to set.
      *
      * \details
-     * Color must be a 12-bit 444-formatted RGB color value. May be called before `begin()`
+     * Color must be an RGB565 color value, or a 12-bit 444-formatted RGB
+     * color value when `DISPLAY_COLOR_444` is defined. May be called before `begin()`
      * or `boot()`.
      *
      * \note
-     * The file `colors.h` contains helpful utilities for creating 12-bit 444-formatted
-     * color values.
+     * The `TFT_` colors and `color565()` of TFT_eSPI give RGB565 values. The
+     * file `colors.h` contains helpful utilities for creating 12-bit
+     * 444-formatted color values.
      *
      * \see getBorderFillColor() getBorderLineColor() setBorderLineColor() getPixelColor()
      * setPixelColor() getBackgroundColor() setBackgroundColor() setColorTheme()
@@ -349,8 +431,11 @@ class Arduboy2Core
      * \param theme The theme to set.
      *
      * \details
-     * Colors in `theme` must be 12-bit 444-formatted RGB color values. May be called before
-     * `begin()` or `boot()`. Setting will take effect on next call to `paintScreen()`.
+     * Colors in `theme` must be 12-bit 444-formatted RGB color values. Unless
+     * `DISPLAY_COLOR_444` is defined they're converted to RGB565 when the
+     * theme is set. May be called before `begin()` or `boot()`. Setting will
+     * take effect on next call to `paintScreen()`. Any fade in progress is
+     * stopped.
      *
      * \note
      * The file `colors.h` contains helpful utilities for creating 12-bit 444-formatted
@@ -358,9 +443,61 @@ class Arduboy2Core
      *
      * \see getPixelColor() setPixelColor() getBackgroundColor() setBackgroundColor()
      * getBorderLineColor() setBorderLineColor() getBorderFillColor() setBorderFillColor()
+     * fadeToTheme()
      */
     void static setColorTheme(Theme theme);
 
+    /** \brief
+     * Change to a color theme gradually.
+     *
+     * \param theme The theme to change to, with 12-bit 444-formatted RGB color
+     * values as for `setColorTheme()`.
+     * \param frames The number of frames the change takes.
+     *
+     * \details
+     * The pixel, background and border colors are mixed from the current
+     * ones to the theme's a little more each time the whole display is
+     * painted, reaching the theme's colors on the `frames`th call to
+     * `display()`. Nothing has to be drawn again to fade, but the whole
+     * display is painted each frame until the fade ends. Parts of the border
+     * are only repainted on the frames their color changes.
+     *
+     * If `frames` is 0 the theme is set immediately, the same as by
+     * `setColorTheme()`. Colors set while a fade is in progress are replaced
+     * by the next step.
+     *
+     * \code{.cpp}
+     * arduboy.fadeToBlack(30);
+     * while (arduboy.fading()) {
+     *   arduboy.display();
+     * }
+     * arduboy.setColorTheme(THEME_DMG);
+     * \endcode
+     *
+     * \see fadeToBlack() fading() setColorTheme()
+     */
+    void static fadeToTheme(Theme theme, uint8_t frames);
+
+    /** \brief
+     * Fade all of the colors to black.
+     *
+     * \param frames The number of frames the fade takes.
+     *
+     * \see fadeToTheme() fading()
+     */
+    void static fadeToBlack(uint8_t frames);
+
+    /** \brief
+     * Check if a fade started by `fadeToTheme()` or `fadeToBlack()` is in
+     * progress.
+     *
+     * \return `true` if the colors will change again on the next call to
+     * `display()`.
+     *
+     * \see fadeToTheme()
+     */
+    bool static fading();
+
     /** \brief
      * Originally meant to paint 8 pixels vertically to the display. This is not
      * implemented for dotMG.
@@ -411,12 +548,364 @@ class Arduboy2Core
      */
     void static paintScreen(uint8_t image[], bool clear = false);
 
+    /** \brief
+     * Paints a rectangular part of an image in RAM to the display.
+     *
+     * \param image A byte array in RAM representing the entire contents of
+     * the display, in the same format used by `paintScreen()`.
+     * \param x,y The location of the top left corner of the area to paint.
+     * \param width,height The size of the area to paint.
+     *
+     * \return The number of bytes of pixel data sent to the display.
+     *
+     * \details
+     * Only the given area of the display is updated. The area is widened to
+     * start and end on multiples of 4 columns and 2 rows, which are the
+     * smallest groups that scale to whole display pixels.
+     *
+     * \see paintScreen()
+     */
+    uint32_t static paintRegion(const uint8_t image[], uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+
+#if PAINT_LAYERS > 0
+    /** \brief
+     * Paints the combined layers of an image to the display.
+     *
+     * \param layers `PAINT_LAYERS + 1` byte arrays in RAM, each in the same
+     * format used by `paintScreen()`.
+     *
+     * \details
+     * Each pixel is shown in the color of the highest priority layer that
+     * has it set, or in the background color if none do.
+     *
+     * \see paintLayerRegion() setLayerColor() setLayerPriority()
+     */
+    void static paintLayers(const uint8_t *const layers[]);
+
+    /** \brief
+     * Paints a rectangular part of the combined layers of an image to the
+     * display.
+     *
+     * \param layers `PAINT_LAYERS + 1` byte arrays in RAM, each in the same
+     * format used by `paintScreen()`.
+     * \param x,y The location of the top left corner of the area to paint.
+     * \param width,height The size of the area to paint.
+     *
+     * \return The number of bytes of pixel data sent to the display.
+     *
+     * \details
+     * The area is widened in the same way as by `paintRegion()`.
+     *
+     * \see paintLayers() paintRegion()
+     */
+    uint32_t static paintLayerRegion(const uint8_t *const layers[], uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+
+    /** \brief
+     * Get the color of a layer's pixels.
+     *
+     * \param layer The layer, from 0 to `PAINT_LAYERS`.
+     *
+     * \see setLayerColor()
+     */
+    uint16_t static getLayerColor(uint8_t layer);
+
+    /** \brief
+     * Set the color of a layer's pixels.
+     *
+     * \param layer The layer, from 0 to `PAINT_LAYERS`.
+     * \param color The color to set, in the same format as for
+     * `setPixelColor()`.
+     *
+     * \details
+     * Layer 0 uses the pixel color, so setting its color is the same as
+     * calling `setPixelColor()`. The other layers start out black, so they
+     * have to be given a color to be seen.
+     *
+     * \see getLayerColor() setLayerPriority()
+     */
+    void static setLayerColor(uint8_t layer, uint16_t color);
+
+    /** \brief
+     * Get the priority of a layer.
+     *
+     * \param layer The layer, from 0 to `PAINT_LAYERS`.
+     *
+     * \see setLayerPriority()
+     */
+    uint8_t static getLayerPriority(uint8_t layer);
+
+    /** \brief
+     * Set the priority of a layer.
+     *
+     * \param layer The layer, from 0 to `PAINT_LAYERS`.
+     * \param priority The priority. Where layers overlap, the one with the
+     * highest priority is shown.
+     *
+     * \details
+     * All layers start with a priority of 0. Layers with the same priority
+     * are ordered by number, with the lowest numbered layer shown, so by
+     * default layer 0 is drawn over layer 1, and layer 1 over layer 2.
+     *
+     * \see getLayerPriority() setLayerColor()
+     */
+    void static setLayerPriority(uint8_t layer, uint8_t priority);
+#endif
+
+#if PAINT_ATTRIBUTES > 0
+    /** \brief
+     * Get the ink color of an attribute.
+     *
+     * \param attribute The attribute, from 0 to `PAINT_ATTRIBUTES - 1`.
+     *
+     * \see setAttributeColors() getAttributePaper()
+     */
+    uint16_t static getAttributeInk(uint8_t attribute);
+
+    /** \brief
+     * Get the paper color of an attribute.
+     *
+     * \param attribute The attribute, from 0 to `PAINT_ATTRIBUTES - 1`.
+     *
+     * \see setAttributeColors() getAttributeInk()
+     */
+    uint16_t static getAttributePaper(uint8_t attribute);
+
+    /** \brief
+     * Set the colors of an attribute.
+     *
+     * \param attribute The attribute, from 0 to `PAINT_ATTRIBUTES - 1`.
+     * \param ink The color of set pixels, in the same format as for
+     * `setPixelColor()`.
+     * \param paper The color of clear pixels.
+     *
+     * \details
+     * Attribute 0 uses the pixel and background colors, so setting its
+     * colors is the same as calling `setPixelColor()` and
+     * `setBackgroundColor()`. The other attributes also use the pixel and
+     * background colors until they're given colors of their own.
+     *
+     * Colors given to attributes 1 and up are used as they are. Unlike the
+     * pixel and background colors, they aren't swapped by `invert()` and
+     * don't change during `fadeToTheme()` or `fadeToBlack()`.
+     *
+     * The whole display is painted on the next call to `display()`.
+     *
+     * \see setCellAttribute()
+     */
+    void static setAttributeColors(uint8_t attribute, uint16_t ink, uint16_t paper);
+
+    /** \brief
+     * Get the attribute of an 8x8 cell of the display.
+     *
+     * \param column The column of the cell, from 0 to `WIDTH / 8 - 1`.
+     * \param row The row of the cell, from 0 to `HEIGHT / 8 - 1`. This is
+     * also the page of the display buffer the cell is in.
+     *
+     * \see setCellAttribute()
+     */
+    uint8_t static getCellAttribute(uint8_t column, uint8_t row);
+
+    /** \brief
+     * Set the attribute of an 8x8 cell of the display.
+     *
+     * \param column The column of the cell, from 0 to `WIDTH / 8 - 1`.
+     * \param row The row of the cell, from 0 to `HEIGHT / 8 - 1`. This is
+     * also the page of the display buffer the cell is in.
+     * \param attribute The attribute, from 0 to `PAINT_ATTRIBUTES - 1`.
+     *
+     * \details
+     * The pixels of the cell are painted in the ink and paper colors of the
+     * attribute. All cells start with attribute 0. An attribute that hasn't
+     * been given colors with `setAttributeColors()` paints the cell in the
+     * pixel and background colors. If the attribute changes, the whole
+     * display is painted on the next call to `display()`.
+     *
+     * \code{.cpp}
+     * arduboy.setAttributeColors(1, TFT_YELLOW, TFT_BLUE);
+     * arduboy.setCellAttribute(0, 0, 1);
+     * \endcode
+     *
+     * \see getCellAttribute() setAttributeColors() clearCellAttributes()
+     */
+    void static setCellAttribute(uint8_t column, uint8_t row, uint8_t attribute);
+
+    /** \brief
+     * Set all cells of the display back to attribute 0.
+     *
+     * \see setCellAttribute()
+     */
+    void static clearCellAttributes();
+#endif
+
+#ifdef DISPLAY_GRAYSCALE
+    /** \brief
+     * Paints a grayscale image to the display.
+     *
+     * \param planes Two byte arrays in RAM, each in the same format used by
+     * `paintScreen()`, holding bit 0 and bit 1 of each pixel's color number.
+     *
+     * \see paintGrayRegion() setGrayColor()
+     */
+    void static paintGrayScreen(const uint8_t *const planes[]);
+
+    /** \brief
+     * Paints a rectangular part of a grayscale image to the display.
+     *
+     * \param planes Two byte arrays in RAM, each in the same format used by
+     * `paintScreen()`, holding bit 0 and bit 1 of each pixel's color number.
+     * \param x,y The location of the top left corner of the area to paint.
+     * \param width,height The size of the area to paint.
+     *
+     * \return The number of bytes of pixel data sent to the display.
+     *
+     * \details
+     * The area is widened in the same way as by `paintRegion()`.
+     *
+     * \see paintGrayScreen() paintRegion()
+     */
+    uint32_t static paintGrayRegion(const uint8_t *const planes[], uint8_t x, uint8_t y, uint8_t width, uint8_t height);
+
+    /** \brief
+     * Get one of the 4 grayscale colors.
+     *
+     * \param number The color number, from 0 to 3.
+     *
+     * \see setGrayColor()
+     */
+    uint16_t static getGrayColor(uint8_t number);
+
+    /** \brief
+     * Set one of the 4 grayscale colors.
+     *
+     * \param number The color number, from 0 to 3.
+     * \param color The color, in the same format as for `setPixelColor()`.
+     *
+     * \details
+     * Color 0 is the background color and color 1 is the pixel color, so
+     * setting them is the same as calling `setBackgroundColor()` or
+     * `setPixelColor()`. Colors 2 and 3 are a third and two thirds of the
+     * way from the background color to the pixel color until they're set,
+     * which gives 4 shades in the order 0, 2, 3, 1.
+     *
+     * \see getGrayColor() resetGrayColors()
+     */
+    void static setGrayColor(uint8_t number, uint16_t color);
+
+    /** \brief
+     * Set grayscale colors 2 and 3 back to shades between the background
+     * and pixel colors.
+     *
+     * \see setGrayColor()
+     */
+    void static resetGrayColors();
+#endif
+
+#ifdef PAINT_ROW_COLORS
+    /** \brief
+     * Set the colors of a row of the display.
+     *
+     * \param row The row, from 0 to `HEIGHT - 1`.
+     * \param color The color of set pixels in the row, in the same format
+     * as for `setPixelColor()`.
+     * \param bgColor The color of clear pixels in the row.
+     *
+     * \details
+     * The row is painted in these colors instead of the pixel and background
+     * colors until `clearRowColors()` is called for it. Changing the colors
+     * of rows doesn't change the display buffer, so they can be set every
+     * frame to animate a picture that isn't redrawn:
+     *
+     * \code{.cpp}
+     * // a blue gradient scrolling up behind white pixels
+     * for (uint8_t row = 0; row < HEIGHT; row++) {
+     *   arduboy.setRowColors(row, TFT_WHITE, ((row + frame) / 2) & 0x1F);
+     * }
+     * \endcode
+     *
+     * If the colors change, the whole display is painted on the next call
+     * to `display()`.
+     *
+     * \see getRowColor() getRowBackgroundColor() clearRowColors()
+     */
+    void static setRowColors(uint8_t row, uint16_t color, uint16_t bgColor);
+
+    /** \brief
+     * Get the color of set pixels in a row of the display.
+     *
+     * \param row The row, from 0 to `HEIGHT - 1`.
+     *
+     * \return The row's own color, or the pixel color if it doesn't have one.
+     *
+     * \see setRowColors()
+     */
+    uint16_t static getRowColor(uint8_t row);
+
+    /** \brief
+     * Get the color of clear pixels in a row of the display.
+     *
+     * \param row The row, from 0 to `HEIGHT - 1`.
+     *
+     * \return The row's own background color, or the background color if
+     * it doesn't have one.
+     *
+     * \see setRowColors()
+     */
+    uint16_t static getRowBackgroundColor(uint8_t row);
+
+    /** \brief
+     * Paint a row of the display in the pixel and background colors again.
+     *
+     * \param row The row, from 0 to `HEIGHT - 1`.
+     *
+     * \see setRowColors()
+     */
+    void static clearRowColors(uint8_t row);
+
+    /** \brief
+     * Paint all rows of the display in the pixel and background colors again.
+     *
+     * \see setRowColors()
+     */
+    void static clearRowColors();
+#endif
+
+    /** \brief
+     * Check if a display transfer is still in progress.
+     *
+     * \return `true` if data is still being sent to the display.
+     *
+     * \details
+     * When `DISPLAY_DMA` is defined in `Arduboy2Core.h`, `paintScreen()`
+     * (and thus `display()`) returns while the last part of the frame is
+     * still being sent to the display in the background. The image buffer
+     * has already been read by then, so it can be drawn to right away.
+     *
+     * Without `DISPLAY_DMA` transfers always complete before
+     * `paintScreen()` returns and this function always returns `false`.
+     *
+     * \see waitDisplay() paintScreen()
+     */
+    bool static displayBusy();
+
+    /** \brief
+     * Wait until any display transfer in progress has completed.
+     *
+     * \details
+     * This function is called by the library before it sends anything else
+     * to the display, so a sketch only needs it when it must know that the
+     * display has been fully updated, or before accessing the display
+     * hardware directly.
+     *
+     * \see displayBusy() paintScreen()
+     */
+    void static waitDisplay();
+
     /** \brief
      * Blank the display screen by setting all pixels off.
      *
      * \details
-     * All pixels on the screen will be written with a value of 0 to turn
-     * them off.
+     * All pixels of the scaled game area of the screen will be set to the
+     * background color. The display buffer isn't changed.
      */
     void static blank();
 
@@ -470,6 +959,10 @@ class Arduboy2Core
      * Once in vertical flip mode, it will remain this way until normal
      * vertical mode is set by calling this function with a value of `false`.
      *
+     * The flip is done by the display's scan direction, so it costs nothing
+     * per frame. Only pixels sent after the call are flipped, so the next
+     * `display()` sends the whole screen.
+     *
      * \see flipHorizontal()
      */
     void static flipVertical(bool flipped);
@@ -488,6 +981,10 @@ class Arduboy2Core
      * Once in horizontal flip mode, it will remain this way until normal
      * horizontal mode is set by calling this function with a value of `false`.
      *
+     * The flip is done by the display's scan direction, so it costs nothing
+     * per frame. Only pixels sent after the call are flipped, so the next
+     * `display()` sends the whole screen.
+     *
      * \see flipVertical()
      */
     void static flipHorizontal(bool flipped);
@@ -666,6 +1163,10 @@ class Arduboy2Core
     // internals
     void static bootDisplay();
     void static bootPins();
+
+    // true if the display contents have changed (colors, blank(), etc.)
+    // since the last full paintScreen(), so a partial update isn't enough
+    bool static fullPaintNeeded();
 };
 
 #endif
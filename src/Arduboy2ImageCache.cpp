@@ -0,0 +1,130 @@
+/**
+ * @file Arduboy2ImageCache.cpp
+ * \brief
+ * The Arduboy2ImageCache class for keeping images decoded by drawCompressed().
+ */
+
+#include "Arduboy2.h"
+
+#if IMAGE_CACHE_BYTES > 0
+
+uint8_t Arduboy2ImageCache::pool[IMAGE_CACHE_BYTES];
+Arduboy2ImageCache::Entry Arduboy2ImageCache::entries[IMAGE_CACHE_ENTRIES];
+uint8_t Arduboy2ImageCache::entryCount = 0;
+uint32_t Arduboy2ImageCache::used = 0;
+uint32_t Arduboy2ImageCache::useCount = 0;
+uint32_t Arduboy2ImageCache::hitCount = 0;
+uint32_t Arduboy2ImageCache::missCount = 0;
+uint32_t Arduboy2ImageCache::evictCount = 0;
+
+const uint8_t *Arduboy2ImageCache::get(const uint8_t *source, uint8_t &width, uint8_t &height)
+{
+  for (uint8_t i = 0; i < entryCount; i++) {
+    Entry &entry = entries[i];
+
+    if (entry.source == source) {
+      hitCount++;
+      entry.lastUse = ++useCount;
+      width = entry.width;
+      height = entry.height;
+      return pool + entry.offset;
+    }
+  }
+
+  missCount++;
+
+  // the header holds the width and height minus 1
+  const uint8_t widthBits = pgm_read_byte(source);
+  const uint8_t heightBits = pgm_read_byte(source + 1);
+
+  if (widthBits == 0xFF || heightBits == 0xFF) {
+    return NULL;
+  }
+
+  const uint16_t size = (widthBits + 1) * (heightBits / 8 + 1);
+
+  if (size > IMAGE_CACHE_BYTES) {
+    return NULL;
+  }
+
+  // make room by removing the least recently drawn images
+  while (entryCount == IMAGE_CACHE_ENTRIES || used + size > IMAGE_CACHE_BYTES) {
+    uint8_t oldest = 0;
+
+    for (uint8_t i = 1; i < entryCount; i++) {
+      if (entries[i].lastUse < entries[oldest].lastUse) {
+        oldest = i;
+      }
+    }
+    evict(oldest);
+  }
+
+  Entry &entry = entries[entryCount++];
+
+  entry.source = source;
+  entry.lastUse = ++useCount;
+  entry.offset = used;
+  entry.size = size;
+  entry.width = widthBits + 1;
+  entry.height = heightBits + 1;
+  used += size;
+
+  Arduboy2Base::decompress(source, pool + entry.offset);
+
+  width = entry.width;
+  height = entry.height;
+  return pool + entry.offset;
+}
+
+// Remove an image and move the ones after it down to close the gap, so the
+// free space is always at the end of the pool.
+void Arduboy2ImageCache::evict(uint8_t index)
+{
+  const uint32_t start = entries[index].offset;
+  const uint16_t size = entries[index].size;
+
+  memmove(pool + start, pool + start + size, used - start - size);
+  used -= size;
+
+  for (uint8_t i = index + 1; i < entryCount; i++) {
+    entries[i - 1] = entries[i];
+    entries[i - 1].offset -= size;
+  }
+  entryCount--;
+  evictCount++;
+}
+
+void Arduboy2ImageCache::flush()
+{
+  entryCount = 0;
+  used = 0;
+}
+
+uint32_t Arduboy2ImageCache::hits()
+{
+  return hitCount;
+}
+
+uint32_t Arduboy2ImageCache::misses()
+{
+  return missCount;
+}
+
+uint32_t Arduboy2ImageCache::evictions()
+{
+  return evictCount;
+}
+
+uint32_t Arduboy2ImageCache::bytesUsed()
+{
+  return used;
+}
+
+void Arduboy2ImageCache::resetStats()
+{
+  hitCount = 0;
+  missCount = 0;
+  evictCount = 0;
+}
+
+#endif
@@ -0,0 +1,136 @@
+/**
+ * @file Arduboy2ImageCache.h
+ * \brief
+ * The Arduboy2ImageCache class for keeping images decoded by drawCompressed().
+ */
+
+#ifndef ARDUBOY2_IMAGE_CACHE_H
+#define ARDUBOY2_IMAGE_CACHE_H
+
+#include <Arduino.h>
+
+// The bytes of RAM set aside for images decoded by drawCompressed(). A
+// decoded image uses its width times its height in pages. When 0, there's
+// no cache and images are decoded every time they're drawn.
+#ifndef IMAGE_CACHE_BYTES
+#define IMAGE_CACHE_BYTES 0
+#endif
+
+// The most images the cache holds at once
+#ifndef IMAGE_CACHE_ENTRIES
+#define IMAGE_CACHE_ENTRIES 8
+#endif
+
+/** \brief
+ * Keep images decoded by `drawCompressed()` in RAM.
+ *
+ * \details
+ * When `IMAGE_CACHE_BYTES` is set in `Arduboy2ImageCache.h`,
+ * `drawCompressed()` decodes each compressed array into a cache of that
+ * many bytes the first time it's drawn, keyed by the array's address. Later
+ * draws of the same array take the decoded image from the cache and draw
+ * it with the `Sprites` bitmap code instead of decoding it again.
+ *
+ * When an image doesn't fit, the least recently drawn images are removed
+ * until it does. Images bigger than the whole cache, or 256 pixels wide or
+ * high, are always decoded while they're drawn.
+ *
+ * The hit and miss counts can be used to choose a size for the cache:
+ *
+ * \code{.cpp}
+ * Serial.print(Arduboy2ImageCache::hits());
+ * Serial.print(' ');
+ * Serial.println(Arduboy2ImageCache::misses());
+ * \endcode
+ *
+ * When `IMAGE_CACHE_BYTES` is 0, all functions do nothing and return 0.
+ *
+ * \see Arduboy2Base::drawCompressed() Arduboy2Base::decompress()
+ */
+class Arduboy2ImageCache
+{
+ public:
+#if IMAGE_CACHE_BYTES > 0
+  /** \brief
+   * Get the decoded image of a compressed array. Called by
+   * `drawCompressed()`.
+   *
+   * \param source A pointer to the compressed bitmap array.
+   * \param width,height Set to the size of the image.
+   *
+   * \return A pointer to the decoded image, or `NULL` if the image can't be
+   * cached.
+   *
+   * \details
+   * The image is decoded and added to the cache if it isn't already in it.
+   * The pointer is only valid until the next call.
+   */
+  static const uint8_t *get(const uint8_t *source, uint8_t &width, uint8_t &height);
+
+  /** \brief
+   * Remove all of the images from the cache.
+   *
+   * \details
+   * This has to be called if a compressed array in RAM has been changed.
+   */
+  static void flush();
+
+  /** \brief
+   * Get the number of times an image was found in the cache.
+   */
+  static uint32_t hits();
+
+  /** \brief
+   * Get the number of times an image had to be decoded.
+   */
+  static uint32_t misses();
+
+  /** \brief
+   * Get the number of images removed to make room for others.
+   */
+  static uint32_t evictions();
+
+  /** \brief
+   * Get the number of bytes used by the images in the cache.
+   */
+  static uint32_t bytesUsed();
+
+  /** \brief
+   * Set the hit, miss and eviction counts to 0.
+   */
+  static void resetStats();
+#else
+  static inline const uint8_t *get(const uint8_t *, uint8_t &, uint8_t &) { return NULL; }
+  static inline void flush() { }
+  static inline uint32_t hits() { return 0; }
+  static inline uint32_t misses() { return 0; }
+  static inline uint32_t evictions() { return 0; }
+  static inline uint32_t bytesUsed() { return 0; }
+  static inline void resetStats() { }
+#endif
+
+#if IMAGE_CACHE_BYTES > 0
+ protected:
+  struct Entry {
+    const uint8_t *source;
+    uint32_t lastUse;
+    uint32_t offset;
+    uint16_t size;
+    uint8_t width;
+    uint8_t height;
+  };
+
+  static void evict(uint8_t index);
+
+  static uint8_t pool[IMAGE_CACHE_BYTES];
+  static Entry entries[IMAGE_CACHE_ENTRIES]; // in the order of their images in pool
+  static uint8_t entryCount;
+  static uint32_t used;
+  static uint32_t useCount;
+  static uint32_t hitCount;
+  static uint32_t missCount;
+  static uint32_t evictCount;
+#endif
+};
+
+#endif
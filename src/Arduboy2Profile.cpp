@@ -0,0 +1,110 @@
+/**
+ * @file Arduboy2Profile.cpp
+ * \brief
+ * The Arduboy2Profile class for measuring where the time of each frame goes.
+ */
+
+#include "Arduboy2Profile.h"
+
+#ifdef FRAME_PROFILING
+
+// Marks that no logic or render phase is being timed
+#define PHASE_NONE PROFILE_SECTIONS
+
+uint32_t Arduboy2Profile::current[PROFILE_SECTIONS];
+uint32_t Arduboy2Profile::history[PROFILE_HISTORY][PROFILE_SECTIONS];
+uint8_t Arduboy2Profile::historyIndex = 0;
+uint8_t Arduboy2Profile::historyCount = 0;
+uint32_t Arduboy2Profile::phaseStart;
+uint8_t Arduboy2Profile::phase = PHASE_NONE;
+bool Arduboy2Profile::frameStarted = false;
+
+void Arduboy2Profile::begin()
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void Arduboy2Profile::startFrame()
+{
+  const uint32_t now = cycles();
+
+  if (frameStarted) {
+    if (phase != PHASE_NONE) {
+      current[phase] += now - phaseStart;
+    }
+    memcpy(history[historyIndex], current, sizeof(current));
+    historyIndex = (historyIndex + 1) % PROFILE_HISTORY;
+    if (historyCount < PROFILE_HISTORY) {
+      historyCount++;
+    }
+  }
+
+  memset(current, 0, sizeof(current));
+  frameStarted = true;
+  phase = PROFILE_LOGIC;
+  phaseStart = now;
+}
+
+void Arduboy2Profile::startRender()
+{
+  const uint32_t now = cycles();
+
+  if (phase == PROFILE_LOGIC) {
+    current[PROFILE_LOGIC] += now - phaseStart;
+    phase = PROFILE_RENDER;
+    phaseStart = now;
+  }
+}
+
+void Arduboy2Profile::startDisplay()
+{
+  if (phase != PHASE_NONE) {
+    current[phase] += cycles() - phaseStart;
+    phase = PHASE_NONE;
+  }
+}
+
+uint32_t Arduboy2Profile::last(uint8_t section)
+{
+  if (historyCount == 0) {
+    return 0;
+  }
+  return history[(historyIndex + PROFILE_HISTORY - 1) % PROFILE_HISTORY][section];
+}
+
+uint32_t Arduboy2Profile::minimum(uint8_t section)
+{
+  uint32_t value = historyCount ? UINT32_MAX : 0;
+
+  for (uint8_t i = 0; i < historyCount; i++) {
+    value = min(value, history[i][section]);
+  }
+  return value;
+}
+
+uint32_t Arduboy2Profile::average(uint8_t section)
+{
+  uint32_t sum = 0;
+
+  if (historyCount == 0) {
+    return 0;
+  }
+  for (uint8_t i = 0; i < historyCount; i++) {
+    sum += history[i][section];
+  }
+  return sum / historyCount;
+}
+
+uint32_t Arduboy2Profile::maximum(uint8_t section)
+{
+  uint32_t value = 0;
+
+  for (uint8_t i = 0; i < historyCount; i++) {
+    value = max(value, history[i][section]);
+  }
+  return value;
+}
+
+#endif
@@ -0,0 +1,236 @@
+/**
+ * @file Arduboy2Profile.h
+ * \brief
+ * The Arduboy2Profile class for measuring where the time of each frame goes.
+ */
+
+#ifndef ARDUBOY2_PROFILE_H
+#define ARDUBOY2_PROFILE_H
+
+#include <Arduino.h>
+
+// If defined, the time spent in each part of a frame is measured using the
+// processor's cycle counter and can be read with the Arduboy2Profile class.
+// When not defined, all of the profiling functions and PROFILE_SCOPE() are
+// empty and compile to nothing.
+//#define FRAME_PROFILING
+
+// The number of past frames the minimum, average and maximum are taken over
+#ifndef PROFILE_HISTORY
+#define PROFILE_HISTORY 16
+#endif
+
+/** \brief
+ * The parts of a frame measured by Arduboy2Profile.
+ *
+ * \details
+ * `PROFILE_LOGIC`, `PROFILE_RENDER`, `PROFILE_PAINT` and `PROFILE_SPI` are
+ * measured by the library. `PROFILE_USER1` to `PROFILE_USER4` are measured
+ * by the sketch using `PROFILE_SCOPE()`.
+ *
+ * \see Arduboy2Profile PROFILE_SCOPE()
+ */
+enum ProfileSection : uint8_t {
+  PROFILE_LOGIC,   /**< From the start of the frame until `startRender()` or `display()`. */
+  PROFILE_RENDER,  /**< From `startRender()` until `display()`. */
+  PROFILE_PAINT,   /**< Scaling the display buffer to display pixels. */
+  PROFILE_SPI,     /**< Sending pixels, or waiting for DMA to send them. */
+  PROFILE_USER1,   /**< Sketch defined. */
+  PROFILE_USER2,   /**< Sketch defined. */
+  PROFILE_USER3,   /**< Sketch defined. */
+  PROFILE_USER4,   /**< Sketch defined. */
+  PROFILE_SECTIONS
+};
+
+/** \brief
+ * Measure the time spent in each part of a frame.
+ *
+ * \details
+ * When `FRAME_PROFILING` is defined in `Arduboy2Profile.h` the Cortex-M4 DWT
+ * cycle counter is used to measure, for each frame, the cycles spent in the
+ * sketch's logic, its rendering, scaling the display buffer in `display()`
+ * and sending it to the display. The minimum, average and maximum over the
+ * last `PROFILE_HISTORY` frames can be read for each part.
+ *
+ * A frame starts when `nextFrame()` returns `true`. Everything until
+ * `display()` is counted as logic, unless the sketch calls `startRender()`
+ * where its drawing begins. Time spent after `display()`, such as waiting
+ * for the next frame, isn't counted.
+ *
+ * Example:
+ *
+ * \code{.cpp}
+ * void loop() {
+ *   if (!arduboy.nextFrame()) {
+ *     return;
+ *   }
+ *   updateGame();
+ *
+ *   Arduboy2Profile::startRender();
+ *   arduboy.clear();
+ *   drawGame();
+ *   arduboy.display();
+ *
+ *   Serial.println(Arduboy2Profile::toMicros(
+ *                  Arduboy2Profile::average(PROFILE_PAINT)));
+ * }
+ * \endcode
+ *
+ * When `FRAME_PROFILING` isn't defined, all functions do nothing and return 0.
+ *
+ * \see ProfileSection PROFILE_SCOPE()
+ */
+class Arduboy2Profile
+{
+ public:
+#ifdef FRAME_PROFILING
+  /** \brief
+   * Enable the cycle counter. Called by `Arduboy2Core::boot()`.
+   */
+  static void begin();
+
+  /** \brief
+   * Mark the start of a frame. Called by `nextFrame()`.
+   *
+   * \details
+   * The times of the previous frame are added to the history used by
+   * `minimum()`, `average()` and `maximum()`.
+   */
+  static void startFrame();
+
+  /** \brief
+   * Mark the point where the sketch starts drawing the frame.
+   *
+   * \details
+   * Time before this call is counted as `PROFILE_LOGIC` and time after it
+   * as `PROFILE_RENDER`.
+   */
+  static void startRender();
+
+  /** \brief
+   * Mark the start of `display()`. Called by the library.
+   */
+  static void startDisplay();
+
+  /** \brief
+   * Add a number of cycles to a part of the current frame.
+   *
+   * \param section The part of the frame.
+   * \param cycles The number of cycles to add.
+   */
+  static void add(uint8_t section, uint32_t cycles)
+  {
+    current[section] += cycles;
+  }
+
+  /** \brief
+   * Get the current value of the cycle counter.
+   *
+   * \return The cycle count, which wraps around about every 35 seconds.
+   */
+  static inline uint32_t cycles() __attribute__((always_inline))
+  {
+    return DWT->CYCCNT;
+  }
+
+  /** \brief
+   * Get the cycles spent in a part of the last complete frame.
+   *
+   * \param section The part of the frame.
+   */
+  static uint32_t last(uint8_t section);
+
+  /** \brief
+   * Get the fewest cycles spent in a part of a frame over recent frames.
+   *
+   * \param section The part of the frame.
+   */
+  static uint32_t minimum(uint8_t section);
+
+  /** \brief
+   * Get the average cycles spent in a part of a frame over recent frames.
+   *
+   * \param section The part of the frame.
+   */
+  static uint32_t average(uint8_t section);
+
+  /** \brief
+   * Get the most cycles spent in a part of a frame over recent frames.
+   *
+   * \param section The part of the frame.
+   */
+  static uint32_t maximum(uint8_t section);
+#else
+  static inline void begin() { }
+  static inline void startFrame() { }
+  static inline void startRender() { }
+  static inline void startDisplay() { }
+  static inline void add(uint8_t, uint32_t) { }
+  static inline uint32_t cycles() { return 0; }
+  static inline uint32_t last(uint8_t) { return 0; }
+  static inline uint32_t minimum(uint8_t) { return 0; }
+  static inline uint32_t average(uint8_t) { return 0; }
+  static inline uint32_t maximum(uint8_t) { return 0; }
+#endif
+
+  /** \brief
+   * Convert a number of cycles to microseconds.
+   *
+   * \param cycles The number of cycles.
+   */
+  static inline uint32_t toMicros(uint32_t cycles)
+  {
+    return cycles / (F_CPU / 1000000);
+  }
+
+#ifdef FRAME_PROFILING
+ protected:
+  static uint32_t current[PROFILE_SECTIONS];
+  static uint32_t history[PROFILE_HISTORY][PROFILE_SECTIONS];
+  static uint8_t historyIndex;
+  static uint8_t historyCount;
+  static uint32_t phaseStart;
+  static uint8_t phase;
+  static bool frameStarted;
+#endif
+};
+
+#ifdef FRAME_PROFILING
+/** \brief
+ * Add the cycles between its construction and destruction to a part of the
+ * frame. Used by `PROFILE_SCOPE()`.
+ */
+class Arduboy2ProfileScope
+{
+ public:
+  Arduboy2ProfileScope(uint8_t section)
+    : section(section), start(Arduboy2Profile::cycles()) { }
+
+  ~Arduboy2ProfileScope()
+  {
+    Arduboy2Profile::add(section, Arduboy2Profile::cycles() - start);
+  }
+
+ private:
+  const uint8_t section;
+  const uint32_t start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+/** \brief
+ * Add the time until the end of the enclosing block to a part of the frame.
+ *
+ * \details
+ * For example, `PROFILE_SCOPE(PROFILE_USER1);` at the top of a function
+ * counts the time spent in every call of it as `PROFILE_USER1`. Does nothing
+ * if `FRAME_PROFILING` isn't defined.
+ */
+#define PROFILE_SCOPE(section) \
+  Arduboy2ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(section)
+#else
+#define PROFILE_SCOPE(section)
+#endif
+
+#endif
@@ -33,6 +33,174 @@ void Sprites::drawPlusMask(int16_t x, int16_t y, const uint8_t *bitmap, uint8_t
 }
 
 
+// Slot header bytes: the frame and the shift, or SLOT_EMPTY
+#define SLOT_EMPTY 0xFF
+
+ShiftedSprite::ShiftedSprite(const uint8_t *bitmap, uint8_t drawMode,
+                             uint8_t *cache, uint16_t cacheSize, const uint8_t *mask)
+  : bitmap(bitmap), mask(mask), cache(cache), drawMode(drawMode)
+{
+  width = pgm_read_byte(bitmap);
+  height = pgm_read_byte(bitmap + 1);
+  slotBytes = SHIFTED_SPRITE_SLOT_BYTES(width, height);
+  slots = cache == NULL ? 0 : min(cacheSize / slotBytes, 255);
+  flush();
+}
+
+void ShiftedSprite::flush()
+{
+  for (uint8_t slot = 0; slot < slots; slot++) {
+    cache[slot * slotBytes + 1] = SLOT_EMPTY;
+  }
+  preloaded = 0;
+  nextSlot = 0;
+}
+
+void ShiftedSprite::preload(uint8_t frames)
+{
+  flush();
+  frames = min(frames, slots / 8);
+  for (uint8_t frame = 0; frame < frames; frame++) {
+    for (uint8_t shift = 0; shift < 8; shift++) {
+      build(frame * 8 + shift, frame, shift);
+    }
+  }
+  preloaded = frames;
+  nextSlot = frames * 8;
+}
+
+const uint8_t *ShiftedSprite::prepare(uint8_t frame, uint8_t shift)
+{
+  if (frame < preloaded) {
+    return cache + (frame * 8 + shift) * slotBytes + 2;
+  }
+
+  const uint8_t first = preloaded * 8;
+
+  if (first >= slots) {
+    return NULL;
+  }
+
+  uint8_t *slot = cache + first * slotBytes;
+
+  for (uint8_t i = first; i < slots; i++, slot += slotBytes) {
+    if (slot[0] == frame && slot[1] == shift) {
+      return slot + 2;
+    }
+  }
+
+  // not cached, so replace the oldest copy
+  const uint8_t i = nextSlot;
+
+  nextSlot = (i + 1 < slots) ? i + 1 : first;
+  build(i, frame, shift);
+  return cache + i * slotBytes + 2;
+}
+
+void ShiftedSprite::build(uint8_t slot, uint8_t frame, uint8_t shift)
+{
+  const uint8_t pages = (height + 7) / 8;
+  const uint16_t frameBytes = width * pages;
+  const uint8_t *image = bitmap + 2 +
+    frame * frameBytes * (drawMode == SPRITE_PLUS_MASK ? 2 : 1);
+  uint8_t *out = cache + slot * slotBytes;
+
+  *out++ = frame;
+  *out++ = shift;
+
+  // Each copy has one more row of bytes than the frame has pages, holding
+  // the bits shifted out of the last page.
+  for (uint8_t row = 0; row <= pages; row++) {
+    for (uint8_t column = 0; column < width; column++) {
+      uint16_t imageBits = 0;
+      uint16_t maskBits = 0;
+
+      // the page at this row (high byte) and the one above it (low byte)
+      for (uint8_t half = 0; half < 2; half++) {
+        const uint8_t page = row - 1 + half;
+
+        if (page >= pages) {
+          continue;
+        }
+
+        const uint16_t ofs = page * width + column;
+        uint8_t i, m;
+
+        switch (drawMode) {
+          case SPRITE_OVERWRITE:
+            i = pgm_read_byte(image + ofs);
+            m = 0xFF;
+            break;
+          case SPRITE_IS_MASK:
+            i = pgm_read_byte(image + ofs);
+            m = i;
+            break;
+          case SPRITE_IS_MASK_ERASE:
+            i = 0;
+            m = pgm_read_byte(image + ofs);
+            break;
+          case SPRITE_MASKED:
+            i = pgm_read_byte(image + ofs);
+            m = pgm_read_byte(mask + frame * frameBytes + ofs);
+            break;
+          default: // SPRITE_PLUS_MASK
+            i = pgm_read_byte(image + ofs * 2);
+            m = pgm_read_byte(image + ofs * 2 + 1);
+            break;
+        }
+        imageBits |= i << (half * 8);
+        maskBits |= m << (half * 8);
+      }
+      *out++ = (imageBits << shift) >> 8;
+      *out++ = (maskBits << shift) >> 8;
+    }
+  }
+}
+
+void Sprites::drawShifted(int16_t x, int16_t y, ShiftedSprite &sprite, uint8_t frame)
+{
+  const uint8_t w = sprite.width;
+  const uint8_t h = sprite.height;
+
+  if (x + w <= 0 || x > WIDTH - 1 || y + h <= 0 || y > HEIGHT - 1)
+    return;
+
+  const uint8_t shift = y & 7;
+  const uint8_t *data = sprite.prepare(frame, shift);
+
+  if (data == NULL) {
+    draw(x, y, sprite.bitmap, frame, sprite.mask, frame, sprite.drawMode);
+    return;
+  }
+
+  Arduboy2Base::markDirty(x, y, w, (h + 7) & ~7);
+
+  const int16_t left = max(x, 0);
+  const uint8_t columns = min(x + w, WIDTH) - left;
+  const uint8_t rows = (h + 7) / 8 + (shift ? 1 : 0);
+  int8_t page = (y - shift) / 8;
+
+  data += (left - x) * 2;
+  for (uint8_t row = 0; row < rows; row++, page++, data += w * 2) {
+    if (page < 0) {
+      continue;
+    }
+    if (page >= HEIGHT / 8) {
+      break;
+    }
+
+    uint8_t *pBuf = Arduboy2Base::sBuffer + page * WIDTH + left;
+    const uint8_t *src = data;
+
+    for (uint8_t i = columns; i > 0; i--) {
+      *pBuf = (*pBuf & ~src[1]) | src[0];
+      pBuf++;
+      src += 2;
+    }
+  }
+}
+
+
 //common functions
 void Sprites::draw(int16_t x, int16_t y,
                    const uint8_t *bitmap, uint8_t frame,
@@ -67,6 +235,135 @@ void Sprites::draw(int16_t x, int16_t y,
   drawBitmap(x, y, bitmap, mask, width, height, drawMode);
 }
 
+// Draw a strip of up to 4 pages of a sprite, one column at a time. The
+// column's bytes are loaded into a 32 bit word for the image and one for
+// the mask, shifted down by yOffset and written to buffer rows firstRow to
+// lastRow of the 5 rows the strip can cover. Inlined for each draw mode so
+// the mode tests are resolved outside of the loop.
+static inline void blitStrip(uint8_t draw_mode, uint8_t *pBuf,
+                             const uint8_t *bofs, const uint8_t *mofs,
+                             uint8_t columns, uint8_t stripPages,
+                             uint16_t pageStride, uint8_t maskStride,
+                             uint8_t yOffset, uint8_t firstRow, uint8_t lastRow)
+  __attribute__((always_inline));
+
+static inline void blitStrip(uint8_t draw_mode, uint8_t *pBuf,
+                             const uint8_t *bofs, const uint8_t *mofs,
+                             uint8_t columns, uint8_t stripPages,
+                             uint16_t pageStride, uint8_t maskStride,
+                             uint8_t yOffset, uint8_t firstRow, uint8_t lastRow)
+{
+  const uint8_t step = draw_mode == SPRITE_PLUS_MASK ? 2 : 1;
+  const uint32_t stripMask = 0xFFFFFFFF >> (32 - stripPages * 8);
+  // the bits shifted out of the word go in the fifth row
+  const uint8_t carryShift = 32 - yOffset;
+
+  pBuf += firstRow * WIDTH;
+
+  for (uint8_t iCol = columns; iCol > 0; iCol--) {
+    uint32_t bitmap_data = 0;
+    uint32_t mask_data = 0;
+    const uint8_t *pImage = bofs;
+    const uint8_t *pMask = mofs;
+
+    for (uint8_t i = 0; i < stripPages * 8; i += 8) {
+      bitmap_data |= (uint32_t)pgm_read_byte(pImage) << i;
+      if (draw_mode == SPRITE_PLUS_MASK) {
+        mask_data |= (uint32_t)pgm_read_byte(pImage + 1) << i;
+      } else if (draw_mode == SPRITE_MASKED) {
+        mask_data |= (uint32_t)pgm_read_byte(pMask) << i;
+        pMask += maskStride;
+      }
+      pImage += pageStride;
+    }
+
+    if (draw_mode == SPRITE_UNMASKED) {
+      mask_data = stripMask;
+    } else if (draw_mode == SPRITE_IS_MASK) {
+      mask_data = bitmap_data;
+    } else if (draw_mode == SPRITE_IS_MASK_ERASE) {
+      mask_data = bitmap_data;
+      bitmap_data = 0;
+    }
+
+    const uint32_t image = bitmap_data << yOffset;
+    const uint32_t keep = ~(mask_data << yOffset);
+    uint8_t *pCol = pBuf;
+
+    for (uint8_t row = firstRow; row <= lastRow; row++) {
+      if (row < 4) {
+        *pCol = (*pCol & (uint8_t)(keep >> (row * 8))) | (uint8_t)(image >> (row * 8));
+      } else {
+        *pCol = (*pCol & ~(uint8_t)(mask_data >> carryShift)) |
+                (uint8_t)(bitmap_data >> carryShift);
+      }
+      pCol += WIDTH;
+    }
+
+    pBuf++;
+    bofs += step;
+    mofs++;
+  }
+}
+
+// Draw a sprite to a display buffer plane. The sprite must be at least
+// partly on the screen. Whole pages of the sprite are written, so when its
+// height isn't a multiple of 8 the rows below it can change too, and
+// callers mark (h + 7) & ~7 rows dirty.
+static void blitPages(uint8_t *buffer, int16_t x, int16_t y,
+                      const uint8_t *bitmap, const uint8_t *mask,
+                      uint8_t w, uint8_t h, uint8_t draw_mode)
+{
+  const uint8_t yOffset = y & 7;
+  const int8_t sRow = (y - yOffset) / 8;
+  const uint8_t pages = h / 8 + (h % 8 > 0 ? 1 : 0); // divide, then round up
+  const uint8_t step = draw_mode == SPRITE_PLUS_MASK ? 2 : 1;
+  const int16_t left = max(x, 0);
+  const uint8_t rendered_width = min(x + w, WIDTH) - left;
+
+  // The sprite is drawn in strips of up to 4 pages, which cover up to 5
+  // rows of the buffer when shifted. Rows off the screen are skipped.
+  for (uint8_t strip = 0; strip < pages; strip += 4) {
+    const uint8_t stripPages = min(pages - strip, 4);
+    const int8_t stripRow = sRow + strip;
+    const int8_t firstRow = max(-stripRow, 0);
+    const int8_t lastRow = min(stripPages - (yOffset ? 0 : 1), HEIGHT / 8 - 1 - stripRow);
+
+    if (stripRow > HEIGHT / 8 - 1)
+      break;
+
+    if (firstRow > lastRow)
+      continue;
+
+    uint8_t *pBuf = buffer + stripRow * WIDTH + left;
+    const uint8_t *bofs = bitmap + (strip * w + (left - x)) * step;
+    const uint8_t *mofs = (mask == NULL ? bitmap : mask) + strip * w + (left - x);
+
+    switch (draw_mode) {
+      case SPRITE_UNMASKED:
+        blitStrip(SPRITE_UNMASKED, pBuf, bofs, mofs, rendered_width, stripPages,
+                  w, w, yOffset, firstRow, lastRow);
+        break;
+      case SPRITE_IS_MASK:
+        blitStrip(SPRITE_IS_MASK, pBuf, bofs, mofs, rendered_width, stripPages,
+                  w, w, yOffset, firstRow, lastRow);
+        break;
+      case SPRITE_IS_MASK_ERASE:
+        blitStrip(SPRITE_IS_MASK_ERASE, pBuf, bofs, mofs, rendered_width, stripPages,
+                  w, w, yOffset, firstRow, lastRow);
+        break;
+      case SPRITE_MASKED:
+        blitStrip(SPRITE_MASKED, pBuf, bofs, mofs, rendered_width, stripPages,
+                  w, w, yOffset, firstRow, lastRow);
+        break;
+      case SPRITE_PLUS_MASK:
+        blitStrip(SPRITE_PLUS_MASK, pBuf, bofs, mofs, rendered_width, stripPages,
+                  w * 2, w, yOffset, firstRow, lastRow);
+        break;
+    }
+  }
+}
+
 void Sprites::drawBitmap(int16_t x, int16_t y,
                          const uint8_t *bitmap, const uint8_t *mask,
                          uint8_t w, uint8_t h, uint8_t draw_mode)
@@ -78,227 +375,47 @@ void Sprites::drawBitmap(int16_t x, int16_t y,
   if (bitmap == NULL)
     return;
 
-  // xOffset technically doesn't need to be 16 bit but the math operations
-  // are measurably faster if it is
-  uint16_t xOffset, ofs;
-  int8_t yOffset = y & 7;
-  int8_t sRow = y / 8;
-  uint8_t loop_h, start_h, rendered_width;
-
-  if (y < 0 && yOffset > 0) {
-    sRow--;
-  }
-
-  // if the left side of the render is offscreen skip those loops
-  if (x < 0) {
-    xOffset = abs(x);
-  } else {
-    xOffset = 0;
-  }
+  Arduboy2Base::markDirty(x, y, w, (h + 7) & ~7);
 
-  // if the right side of the render is offscreen skip those loops
-  if (x + w > WIDTH - 1) {
-    rendered_width = ((WIDTH - x) - xOffset);
-  } else {
-    rendered_width = (w - xOffset);
-  }
+  blitPages(Arduboy2Base::sBuffer, x, y, bitmap, mask, w, h, draw_mode);
+}
 
-  // if the top side of the render is offscreen skip those loops
-  if (sRow < -1) {
-    start_h = abs(sRow) - 1;
-  } else {
-    start_h = 0;
-  }
+#ifdef DISPLAY_GRAYSCALE
+void Sprites::drawGrayOverwrite(int16_t x, int16_t y, const uint8_t *bitmap, uint8_t frame)
+{
+  drawGray(x, y, bitmap, frame, NULL, 0, SPRITE_OVERWRITE);
+}
 
-  loop_h = h / 8 + (h % 8 > 0 ? 1 : 0); // divide, then round up
+void Sprites::drawGrayExternalMask(int16_t x, int16_t y, const uint8_t *bitmap,
+                                   const uint8_t *mask, uint8_t frame, uint8_t mask_frame)
+{
+  drawGray(x, y, bitmap, frame, mask, mask_frame, SPRITE_MASKED);
+}
 
-  // if (sRow + loop_h - 1 > (HEIGHT/8)-1)
-  if (sRow + loop_h > (HEIGHT / 8)) {
-    loop_h = (HEIGHT / 8) - sRow;
-  }
+// Draw the two planes of a frame to sBuffer and grayBuffer with the same mask
+void Sprites::drawGray(int16_t x, int16_t y,
+                       const uint8_t *bitmap, uint8_t frame,
+                       const uint8_t *mask, uint8_t mask_frame,
+                       uint8_t drawMode)
+{
+  if (bitmap == NULL)
+    return;
 
-  // prepare variables for loops later so we can compare with 0
-  // instead of comparing two variables
-  loop_h -= start_h;
-
-  sRow += start_h;
-  ofs = (sRow * WIDTH) + x + xOffset;
-  uint8_t *bofs = (uint8_t *)bitmap + (start_h * w) + xOffset;
-  uint8_t data;
-
-  uint8_t mul_amt = 1 << yOffset;
-  uint16_t mask_data;
-  uint16_t bitmap_data;
-
-  switch (draw_mode) {
-    case SPRITE_UNMASKED:
-      // we only want to mask the 8 bits of our own sprite, so we can
-      // calculate the mask before the start of the loop
-      mask_data = ~(0xFF * mul_amt);
-      // really if yOffset = 0 you have a faster case here that could be
-      // optimized
-      for (uint8_t a = 0; a < loop_h; a++) {
-        for (uint8_t iCol = 0; iCol < rendered_width; iCol++) {
-          bitmap_data = pgm_read_byte(bofs) * mul_amt;
-
-          if (sRow >= 0) {
-            data = Arduboy2Base::sBuffer[ofs];
-            data &= (uint8_t)(mask_data);
-            data |= (uint8_t)(bitmap_data);
-            Arduboy2Base::sBuffer[ofs] = data;
-          }
-          if (yOffset != 0 && sRow < 7) {
-            data = Arduboy2Base::sBuffer[(uint16_t)(ofs + WIDTH)];
-            data &= (*((unsigned char *) (&mask_data) + 1));
-            data |= (*((unsigned char *) (&bitmap_data) + 1));
-            Arduboy2Base::sBuffer[(uint16_t)(ofs + WIDTH)] = data;
-          }
-          ofs++;
-          bofs++;
-        }
-        sRow++;
-        bofs += w - rendered_width;
-        ofs += WIDTH - rendered_width;
-      }
-      break;
+  const uint8_t w = pgm_read_byte(bitmap);
+  const uint8_t h = pgm_read_byte(bitmap + 1);
 
-    case SPRITE_IS_MASK:
-      for (uint8_t a = 0; a < loop_h; a++) {
-        for (uint8_t iCol = 0; iCol < rendered_width; iCol++) {
-          bitmap_data = pgm_read_byte(bofs) * mul_amt;
-          if (sRow >= 0) {
-            Arduboy2Base::sBuffer[ofs] |= (uint8_t)(bitmap_data);
-          }
-          if (yOffset != 0 && sRow < 7) {
-            Arduboy2Base::sBuffer[(uint16_t)(ofs + WIDTH)] |= (*((unsigned char *) (&bitmap_data) + 1));
-          }
-          ofs++;
-          bofs++;
-        }
-        sRow++;
-        bofs += w - rendered_width;
-        ofs += WIDTH - rendered_width;
-      }
-      break;
+  if (x + w <= 0 || x > WIDTH - 1 || y + h <= 0 || y > HEIGHT - 1)
+    return;
 
-    case SPRITE_IS_MASK_ERASE:
-      for (uint8_t a = 0; a < loop_h; a++) {
-        for (uint8_t iCol = 0; iCol < rendered_width; iCol++) {
-          bitmap_data = pgm_read_byte(bofs) * mul_amt;
-          if (sRow >= 0) {
-            Arduboy2Base::sBuffer[ofs]  &= ~(uint8_t)(bitmap_data);
-          }
-          if (yOffset != 0 && sRow < 7) {
-            Arduboy2Base::sBuffer[(uint16_t)(ofs + WIDTH)] &= ~(*((unsigned char *) (&bitmap_data) + 1));
-          }
-          ofs++;
-          bofs++;
-        }
-        sRow++;
-        bofs += w - rendered_width;
-        ofs += WIDTH - rendered_width;
-      }
-      break;
+  const uint16_t frameBytes = w * (h / 8 + (h % 8 > 0 ? 1 : 0));
+  const uint8_t *low = bitmap + 2 + frame * frameBytes * 2;
 
-    case SPRITE_MASKED:
-      uint8_t *mask_ofs;
-      mask_ofs = (uint8_t *)mask + (start_h * w) + xOffset;
-      for (uint8_t a = 0; a < loop_h; a++) {
-        for (uint8_t iCol = 0; iCol < rendered_width; iCol++) {
-          // NOTE: you might think in the yOffset==0 case that this results
-          // in more effort, but in all my testing the compiler was forcing
-          // 16-bit math to happen here anyways, so this isn't actually
-          // compiling to more code than it otherwise would. If the offset
-          // is 0 the high part of the word will just never be used.
-
-          // load data and bit shift
-          // mask needs to be bit flipped
-          mask_data = ~(pgm_read_byte(mask_ofs) * mul_amt);
-          bitmap_data = pgm_read_byte(bofs) * mul_amt;
-
-          if (sRow >= 0) {
-            data = Arduboy2Base::sBuffer[ofs];
-            data &= (uint8_t)(mask_data);
-            data |= (uint8_t)(bitmap_data);
-            Arduboy2Base::sBuffer[ofs] = data;
-          }
-          if (yOffset != 0 && sRow < 7) {
-            data = Arduboy2Base::sBuffer[(uint16_t)(ofs + WIDTH)];
-            data &= (*((unsigned char *) (&mask_data) + 1));
-            data |= (*((unsigned char *) (&bitmap_data) + 1));
-            Arduboy2Base::sBuffer[(uint16_t)(ofs + WIDTH)] = data;
-          }
-          ofs++;
-          mask_ofs++;
-          bofs++;
-        }
-        sRow++;
-        bofs += w - rendered_width;
-        mask_ofs += w - rendered_width;
-        ofs += WIDTH - rendered_width;
-      }
-      break;
+  if (mask != NULL)
+    mask += mask_frame * frameBytes;
 
+  Arduboy2Base::markDirty(x, y, w, (h + 7) & ~7);
 
-    case SPRITE_PLUS_MASK:
-      uint8_t * sprite_ofs = (uint8_t *)(bitmap + ((start_h * w) + xOffset) * 2);
-      uint8_t * buffer_ofs = (Arduboy2Base::sBuffer + ofs);
-      uint8_t * buffer_ofs_2 = (buffer_ofs + 128);
-
-      const uint8_t sprite_ofs_jump = ((w - rendered_width) * 2);
-      const uint8_t buffer_ofs_jump = (WIDTH - rendered_width);
-
-      for(uint8_t yi = loop_h; yi > 0; --yi)
-      {
-          for(uint8_t xi = rendered_width; xi > 0; --xi)
-          {
-              // load bitmap and mask data
-              bitmap_data = pgm_read_byte(sprite_ofs);
-              ++sprite_ofs;
-              mask_data = pgm_read_byte(sprite_ofs);
-              ++sprite_ofs;
-
-              // shift mask and buffer data
-              if(yOffset != 0)
-              {
-                  bitmap_data *= mul_amt;
-                  mask_data *= mul_amt;
-
-                  // SECOND PAGE
-                  if(sRow < 7)
-                  {
-                      data = *buffer_ofs_2;
-                      mask_data = (mask_data & 0x00FF) | ((~mask_data)  & 0xFF00);
-                      data &= (uint8_t)(mask_data >> 8);
-                      data |= (uint8_t)(bitmap_data >> 8);
-                      *buffer_ofs_2 = data;
-                      ++buffer_ofs_2;
-                  }
-              }
-
-              // FIRST_PAGE
-              if(sRow >= 0)
-              {
-                  data = *buffer_ofs;
-                  mask_data = (mask_data & 0xFF00) | ((~mask_data)  & 0x00FF);
-                  data &= (uint8_t)(mask_data);
-                  data |= (uint8_t)(bitmap_data);
-                  *buffer_ofs = data;
-                  ++buffer_ofs;
-              }
-              else
-              {
-                ++buffer_ofs;
-              }
-          }
-          if(yi > 0)
-          {
-              ++sRow;
-              sprite_ofs += sprite_ofs_jump;
-              buffer_ofs += buffer_ofs_jump;
-              buffer_ofs_2 += buffer_ofs_jump;
-          }
-      }
-      break;
-  }
+  blitPages(Arduboy2Base::sBuffer, x, y, low, mask, w, h, drawMode);
+  blitPages(Arduboy2Base::grayBuffer, x, y, low + frameBytes, mask, w, h, drawMode);
 }
+#endif
@@ -10,6 +10,123 @@
 #include "Arduboy2.h"
 #include "SpritesCommon.h"
 
+/** \brief
+ * The number of cache bytes needed to hold one pre-shifted copy of a frame
+ * of a `ShiftedSprite`.
+ *
+ * \param width The width of the sprite in pixels.
+ * \param height The height of the sprite in pixels.
+ *
+ * \details
+ * A cache given to a `ShiftedSprite` holds as many copies as fit in it.
+ * Each frame can be drawn at 8 different vertical offsets within a page, so
+ * `SHIFTED_SPRITE_SLOT_BYTES(w, h) * 8 * frames` bytes holds every copy a
+ * sprite can need.
+ *
+ * \see ShiftedSprite
+ */
+#define SHIFTED_SPRITE_SLOT_BYTES(width, height) \
+  (2 + (width) * (((height) + 15) / 8) * 2)
+
+/** \brief
+ * A sprite drawn from copies pre-shifted to the Y offsets it's drawn at.
+ *
+ * \details
+ * Drawing a sprite at a Y coordinate that isn't a multiple of 8 means
+ * every byte of it has to be shifted and split across two pages of the
+ * display buffer. A `ShiftedSprite` keeps copies of its frames already
+ * shifted, with the image and mask for each display buffer byte stored
+ * together, so `Sprites::drawShifted()` only has to mask and store them.
+ *
+ * The sprite uses the same arrays as the `Sprites` functions and a cache
+ * in RAM provided by the sketch, which is how the memory used is chosen
+ * for each sprite:
+ *
+ * - With a cache big enough for every frame at all 8 offsets, calling
+ *   `preload()` builds all of the copies once and drawing never shifts.
+ * - With a smaller cache, copies are built the first time a frame is drawn
+ *   at an offset and replace the oldest copy when the cache is full. This
+ *   suits sprites that are only drawn at a few offsets.
+ * - With no cache, the sprite is drawn by the usual `Sprites` functions.
+ *
+ * \code{.cpp}
+ * // 4 frames of an 8x8 bullet, all offsets: 4 * 8 * 34 bytes
+ * uint8_t bulletCache[SHIFTED_SPRITE_SLOT_BYTES(8, 8) * 8 * 4];
+ * ShiftedSprite bullet(bulletSprite, SPRITE_IS_MASK, bulletCache,
+ *                      sizeof(bulletCache));
+ *
+ * void setup() {
+ *   arduboy.begin();
+ *   bullet.preload(4);
+ * }
+ *
+ * void drawBullets() {
+ *   for (uint8_t i = 0; i < bulletCount; i++) {
+ *     Sprites::drawShifted(bulletX[i], bulletY[i], bullet, bulletFrame[i]);
+ *   }
+ * }
+ * \endcode
+ *
+ * \see Sprites::drawShifted() SHIFTED_SPRITE_SLOT_BYTES()
+ */
+class ShiftedSprite
+{
+  public:
+    /** \brief
+     * Create a sprite with a cache for its pre-shifted copies.
+     *
+     * \param bitmap A pointer to the array containing the image frames, in
+     * the format used by `Sprites`.
+     * \param drawMode How the sprite is drawn: `SPRITE_OVERWRITE`,
+     * `SPRITE_IS_MASK` (as `drawSelfMasked()`), `SPRITE_IS_MASK_ERASE`
+     * (as `drawErase()`), `SPRITE_MASKED` (as `drawExternalMask()`, using
+     * the same frame of the mask as of the image) or `SPRITE_PLUS_MASK`.
+     * \param cache A RAM buffer for the copies, or `NULL`.
+     * \param cacheSize The size of the buffer in bytes.
+     * \param mask A pointer to the array containing the mask frames, for
+     * `SPRITE_MASKED`.
+     */
+    ShiftedSprite(const uint8_t *bitmap, uint8_t drawMode,
+                  uint8_t *cache, uint16_t cacheSize, const uint8_t *mask = NULL);
+
+    /** \brief
+     * Build the copies of the first frames at every offset.
+     *
+     * \param frames The number of frames, starting from frame 0.
+     *
+     * \details
+     * As many copies as fit in the cache are built. Copies that are built
+     * by `preload()` are never replaced.
+     */
+    void preload(uint8_t frames);
+
+    /** \brief
+     * Discard all of the copies in the cache.
+     *
+     * \details
+     * This has to be called if the arrays used by the sprite have been
+     * changed. Copies are built again as the sprite is drawn.
+     */
+    void flush();
+
+  protected:
+    friend class Sprites;
+
+    const uint8_t *prepare(uint8_t frame, uint8_t shift);
+    void build(uint8_t slot, uint8_t frame, uint8_t shift);
+
+    const uint8_t *bitmap;
+    const uint8_t *mask;
+    uint8_t *cache;
+    uint16_t slotBytes;
+    uint8_t slots;
+    uint8_t preloaded; // frames with all of their offsets at the start of the cache
+    uint8_t nextSlot;
+    uint8_t drawMode;
+    uint8_t width;
+    uint8_t height;
+};
+
 /** \brief
  * A class for drawing animated sprites from image and mask bitmaps.
  *
@@ -243,6 +360,68 @@ class Sprites
      */
     static void drawSelfMasked(int16_t x, int16_t y, const uint8_t *bitmap, uint8_t frame);
 
+#ifdef DISPLAY_GRAYSCALE
+    /** \brief
+     * Draw a grayscale sprite by replacing the existing content completely.
+     *
+     * \param x,y The coordinates of the top left pixel location.
+     * \param bitmap A pointer to the array containing the image frames.
+     * \param frame The frame number of the image to draw.
+     *
+     * \details
+     * Only available when `DISPLAY_GRAYSCALE` is defined in
+     * `Arduboy2Core.h`. Each frame of the array has two planes in the usual
+     * sprite format, one after the other: bit 0 of each pixel's color
+     * number, which is drawn to `sBuffer`, then bit 1, which is drawn to
+     * `grayBuffer`. The array starts with the width and height as usual.
+     *
+     * Both planes are drawn like `drawOverwrite()`.
+     *
+     * \see drawGrayExternalMask() Arduboy2Base::grayBuffer
+     */
+    static void drawGrayOverwrite(int16_t x, int16_t y, const uint8_t *bitmap, uint8_t frame);
+
+    /** \brief
+     * Draw a grayscale sprite with a separate mask.
+     *
+     * \param x,y The coordinates of the top left pixel location.
+     * \param bitmap A pointer to the array containing the image frames.
+     * \param mask A pointer to the array containing the mask frames.
+     * \param frame The frame number of the image to draw.
+     * \param mask_frame The frame number for the mask to use (can be
+     * different from the image frame number).
+     *
+     * \details
+     * The image frames have two planes, as described for
+     * `drawGrayOverwrite()`. The mask frames have one, which is used for
+     * both planes as in `drawExternalMask()`, so pixels with a 0 bit in the
+     * mask keep their color.
+     *
+     * \see drawGrayOverwrite() Arduboy2Base::grayBuffer
+     */
+    static void drawGrayExternalMask(int16_t x, int16_t y, const uint8_t *bitmap,
+                                     const uint8_t *mask, uint8_t frame, uint8_t mask_frame);
+#endif
+
+    /** \brief
+     * Draw a sprite from its pre-shifted copies.
+     *
+     * \param x,y The coordinates of the top left pixel location.
+     * \param sprite The sprite, which holds the arrays, draw mode and cache.
+     * \param frame The frame number of the image to draw.
+     *
+     * \details
+     * The result is the same as drawing the sprite with the `Sprites`
+     * function for its draw mode. The copy of the frame for the offset of Y
+     * within a page is taken from the sprite's cache, building it first if
+     * needed, and its bytes are masked and stored into the display buffer
+     * without shifting. If the sprite has no cache the `Sprites` function
+     * for its draw mode is used.
+     *
+     * \see ShiftedSprite
+     */
+    static void drawShifted(int16_t x, int16_t y, ShiftedSprite &sprite, uint8_t frame);
+
     // Master function. Needs to be abstracted into separate function for
     // every render type.
     // (Not officially part of the API)
@@ -251,6 +430,14 @@ class Sprites
                      const uint8_t *mask, uint8_t sprite_frame,
                      uint8_t drawMode);
 
+#ifdef DISPLAY_GRAYSCALE
+    // (Not officially part of the API)
+    static void drawGray(int16_t x, int16_t y,
+                         const uint8_t *bitmap, uint8_t frame,
+                         const uint8_t *mask, uint8_t mask_frame,
+                         uint8_t drawMode);
+#endif
+
     // (Not officially part of the API)
     static void drawBitmap(int16_t x, int16_t y,
                            const uint8_t *bitmap, const uint8_t *mask,
@@ -79,6 +79,8 @@ void SpritesB::drawBitmap(int16_t x, int16_t y,
   if (bitmap == NULL)
     return;
 
+  Arduboy2Base::markDirty(x, y, w, (h + 7) & ~7);
+
   // xOffset technically doesn't need to be 16 bit but the math operations
   // are measurably faster if it is
   uint16_t xOffset, ofs;
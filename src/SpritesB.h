@@ -20,6 +20,11 @@
  * difference is that the functions in this class are optimized for smaller
  * code size rather than execution speed.
  *
+ * `SpritesB` keeps a single loop that draws one page of a column at a time
+ * for every draw mode. `Sprites` handles up to four pages of each column at
+ * once, with a copy of its loop for each draw mode, so it's faster but uses
+ * more code.
+ *
  * See the `Sprites` class documentation for details on the use of the
  * functions in this class.
  *